@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+
+#include "../syscall.h"
+
+static const int kNumBufs = 4;
+static const size_t kBufSize = 4096;
+
+char bufs[kNumBufs][kBufSize];
+uint64_t req_ids[kNumBufs]; // 0 なら空いている
+
+// 非同期読み込みを常に kNumBufs 個出しておき，完了した順に次を出す
+extern "C" int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: aread <file>\n");
+    exit(1);
+  }
+
+  auto [fd, err_open] = SyscallOpenFile(argv[1], O_RDONLY);
+  if (err_open) {
+    printf("failed to open %s: %s\n", argv[1], strerror(err_open));
+    exit(1);
+  }
+
+  const auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+  for (int i = 0; i < kNumBufs; ++i) {
+    auto [id, err] = SyscallAsyncRead(fd, bufs[i], kBufSize);
+    if (err) {
+      printf("AsyncRead failed: %s\n", strerror(err));
+      exit(1);
+    }
+    req_ids[i] = id;
+  }
+
+  // 要求は出した順に完了するので，最初に 0 バイトが返れば残りも 0 バイト
+  size_t total = 0;
+  int in_flight = kNumBufs, num_reads = 0;
+  bool eof = false;
+  AppEvent events[kNumBufs];
+  while (in_flight > 0) {
+    auto [n, err] = SyscallReadEvent(events, kNumBufs);
+    if (err) {
+      printf("ReadEvent failed: %s\n", strerror(err));
+      exit(1);
+    }
+    for (size_t e = 0; e < n; ++e) {
+      if (events[e].type == AppEvent::kQuit) {
+        exit(1);
+      } else if (events[e].type != AppEvent::kIOComplete) {
+        continue;
+      }
+      const auto &io = events[e].arg.io;
+      const int i = std::find(req_ids, req_ids + kNumBufs, io.id) - req_ids;
+      if (i == kNumBufs) {
+        continue;
+      }
+      req_ids[i] = 0;
+      --in_flight;
+      ++num_reads;
+      total += io.result;
+      if (io.result == 0) {
+        eof = true;
+      }
+      if (!eof) {
+        req_ids[i] = SyscallAsyncRead(fd, bufs[i], kBufSize).value;
+        in_flight += req_ids[i] != 0;
+      }
+    }
+  }
+  const auto tick_end = SyscallGetCurrentTick().value;
+
+  const unsigned long elapsed_ms = (tick_end - tick_start) * 1000 / timer_freq;
+  printf("%lu bytes in %lu ms (%d reads): %lu KiB/s\n", total, elapsed_ms,
+         num_reads, elapsed_ms ? total * 1000 / 1024 / elapsed_ms : 0);
+  exit(0);
+}
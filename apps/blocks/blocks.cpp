@@ -3,6 +3,7 @@
 #include <bitset>
 #include <cmath>
 #include <cstdlib>
+#include <vector>
 
 using namespace std;
 
@@ -21,8 +22,17 @@ const int kBarSpeed = kCanvasWidth / 2; // pixels/sec
 const int kBallSpeed = kBarSpeed;
 
 array<bitset<kNumBlocksX>, kNumBlocksY> blocks;
+vector<DrawCommand> cmds; // 1 フレーム分の描画命令
+
+void FillRectangle(int x, int y, int w, int h, uint32_t color) {
+  DrawCommand cmd;
+  cmd.type = DrawCommand::kFillRectangle;
+  cmd.color = color;
+  cmd.arg.fill = {x, y, w, h};
+  cmds.push_back(cmd);
+}
 
-void DrawBlocks(uint64_t layer_id) {
+void DrawBlocks() {
   for (int by = 0; by < kNumBlocksY; ++by) {
     const int y = 24 + kGapHeight + by * kBlockHeight;
     const uint32_t color = 0xff << (by % 3) * 8;
@@ -31,23 +41,21 @@ void DrawBlocks(uint64_t layer_id) {
       if (blocks[by][bx]) {
         const int x = 4 + kGapWidth + bx * kBlockWidth;
         const uint32_t c = color | (0xff << ((bx + by) % 3) * 8);
-        SyscallWinFillRectangle(layer_id, x, y, kBlockWidth, kBlockHeight, c);
+        FillRectangle(x, y, kBlockWidth, kBlockHeight, c);
       }
     }
   }
 }
 
-void DrawBar(uint64_t layer_id, int bar_x) {
-  SyscallWinFillRectangle(layer_id, 4 + bar_x, 24 + kBarY, kBarWidth,
-                          kBarHeight, 0xffffff);
+void DrawBar(int bar_x) {
+  FillRectangle(4 + bar_x, 24 + kBarY, kBarWidth, kBarHeight, 0xffffff);
 }
 
-void DrawBall(uint64_t layer_id, int x, int y) {
-  SyscallWinFillRectangle(layer_id, 4 + x - kBallRadius, 24 + y - kBallRadius,
-                          2 * kBallRadius, 2 * kBallRadius, 0x007f00);
-  SyscallWinFillRectangle(layer_id, 4 + x - kBallRadius / 2,
-                          24 + y - kBallRadius / 2, kBallRadius, kBallRadius,
-                          0x00ff00);
+void DrawBall(int x, int y) {
+  FillRectangle(4 + x - kBallRadius, 24 + y - kBallRadius, 2 * kBallRadius,
+                2 * kBallRadius, 0x007f00);
+  FillRectangle(4 + x - kBallRadius / 2, 24 + y - kBallRadius / 2, kBallRadius,
+                kBallRadius, 0x00ff00);
 }
 
 template <class T> T LimitRange(const T &x, const T &min, const T &max) {
@@ -81,15 +89,15 @@ extern "C" void main(int argc, char **argv) {
 
   for (;;) {
     // 画面を一旦クリアし，各種オブジェクトを描画
-    SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW, 4, 24, kCanvasWidth,
-                            kCanvasHeight, 0);
+    cmds.clear();
+    FillRectangle(4, 24, kCanvasWidth, kCanvasHeight, 0);
 
-    DrawBlocks(layer_id | LAYER_NO_REDRAW);
-    DrawBar(layer_id | LAYER_NO_REDRAW, bar_x);
+    DrawBlocks();
+    DrawBar(bar_x);
     if (ball_y >= 0) {
-      DrawBall(layer_id | LAYER_NO_REDRAW, ball_x, ball_y);
+      DrawBall(ball_x, ball_y);
     }
-    SyscallWinRedraw(layer_id);
+    SyscallWinDrawCommands(layer_id, cmds.data(), cmds.size());
 
     static unsigned long prev_timeout = 0;
     if (prev_timeout == 0) {
@@ -0,0 +1,24 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "../syscall.h"
+
+extern "C" int main(int argc, char **argv) {
+  int seconds = 10;
+  if (argc >= 2) {
+    seconds = atoi(argv[1]);
+  }
+
+  const auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+  const unsigned long tick_end = tick_start + seconds * timer_freq;
+
+  volatile unsigned long count = 0;
+  while (SyscallGetCurrentTick().value < tick_end) {
+    for (int i = 0; i < 1000000; ++i) {
+      ++count;
+    }
+  }
+
+  printf("busy: %lu M loops in %d s.\n", count / 1000000, seconds);
+  exit(0);
+}
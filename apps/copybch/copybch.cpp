@@ -0,0 +1,150 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../syscall.h"
+
+static const char *kSrc = "cbsrc";
+static const char *kDest = "cbdest";
+
+size_t block_size;
+
+// 以前の cp と同じく 256 バイトずつ，stdio のバッファは BUFSIZ
+void CopyStdioSmall() {
+  FILE *src = fopen(kSrc, "r");
+  FILE *dest = fopen(kDest, "w");
+  setvbuf(src, nullptr, _IOFBF, BUFSIZ);
+  setvbuf(dest, nullptr, _IOFBF, BUFSIZ);
+  char buf[256];
+  size_t bytes;
+  while ((bytes = fread(buf, 1, sizeof(buf), src)) > 0) {
+    fwrite(buf, 1, bytes, dest);
+  }
+  fclose(src);
+  fclose(dest);
+}
+
+// 256 バイトずつだが，stdio のバッファは fstat の st_blksize に任せる
+void CopyStdio() {
+  FILE *src = fopen(kSrc, "r");
+  FILE *dest = fopen(kDest, "w");
+  char buf[256];
+  size_t bytes;
+  while ((bytes = fread(buf, 1, sizeof(buf), src)) > 0) {
+    fwrite(buf, 1, bytes, dest);
+  }
+  fclose(src);
+  fclose(dest);
+}
+
+void CopyReadWrite() {
+  const int src = open(kSrc, O_RDONLY);
+  const int dest = open(kDest, O_WRONLY | O_CREAT | O_TRUNC);
+  std::vector<char> buf(block_size);
+  ssize_t bytes;
+  while ((bytes = read(src, buf.data(), buf.size())) > 0) {
+    write(dest, buf.data(), bytes);
+  }
+  close(src);
+  close(dest);
+}
+
+void CopyPreadPwrite() {
+  const int src = open(kSrc, O_RDONLY);
+  const int dest = open(kDest, O_WRONLY | O_CREAT | O_TRUNC);
+  std::vector<char> buf(block_size);
+  off_t offset = 0;
+  ssize_t bytes;
+  while ((bytes = pread(src, buf.data(), buf.size(), offset)) > 0) {
+    pwrite(dest, buf.data(), bytes, offset);
+    offset += bytes;
+  }
+  close(src);
+  close(dest);
+}
+
+// 4 ブロックを 1 回のシステムコールで読み書きする
+void CopyVector() {
+  const int src = open(kSrc, O_RDONLY);
+  const int dest = open(kDest, O_WRONLY | O_CREAT | O_TRUNC);
+  std::vector<char> buf(4 * block_size);
+  IOVec iov[4];
+  for (int i = 0; i < 4; ++i) {
+    iov[i] = {&buf[i * block_size], block_size};
+  }
+  while (true) {
+    auto [bytes, err] = SyscallReadFileV(src, iov, 4);
+    if (err || bytes == 0) {
+      break;
+    }
+    IOVec out[4];
+    int n = 0;
+    for (size_t rest = bytes; rest > 0; ++n) {
+      out[n] = {iov[n].base, rest < block_size ? rest : block_size};
+      rest -= out[n].len;
+    }
+    SyscallWriteFileV(dest, out, n);
+  }
+  close(src);
+  close(dest);
+}
+
+// ユーザ空間のバッファを使わず，カーネルの中で写す
+void CopyFileRange() {
+  const int src = open(kSrc, O_RDONLY);
+  const int dest = open(kDest, O_WRONLY | O_CREAT | O_TRUNC);
+  while (SyscallCopyFileRange(src, dest, 1ul << 30).value > 0) {
+  }
+  close(src);
+  close(dest);
+}
+
+// ファイルのコピーの速度を方法ごとに測る
+extern "C" int main(int argc, char **argv) {
+  const int size_kib = argc >= 2 ? atoi(argv[1]) : 1024;
+  if (size_kib < 1) {
+    printf("Usage: copybch [KiB]\n");
+    exit(1);
+  }
+
+  const int fd = open(kSrc, O_WRONLY | O_CREAT | O_TRUNC);
+  if (fd < 0) {
+    printf("failed to create %s: %s\n", kSrc, strerror(errno));
+    exit(1);
+  }
+  char chunk[1024];
+  for (int i = 0; i < size_kib; ++i) {
+    memset(chunk, 'a' + i % 26, sizeof(chunk));
+    write(fd, chunk, sizeof(chunk));
+  }
+  struct stat st;
+  fstat(fd, &st);
+  block_size = st.st_blksize;
+  close(fd);
+  printf("%d KiB, block size %lu\n", size_kib, block_size);
+
+  const struct {
+    const char *name;
+    void (*copy)();
+  } methods[] = {
+      {"stdio 256B/BUFSIZ", CopyStdioSmall},
+      {"stdio 256B/blksize", CopyStdio},
+      {"read/write", CopyReadWrite},
+      {"pread/pwrite", CopyPreadPwrite},
+      {"readv/writev x4", CopyVector},
+      {"copy_file_range", CopyFileRange},
+  };
+  for (const auto &m : methods) {
+    const uint64_t start = GetCurrentTimeNs();
+    m.copy();
+    const uint64_t elapsed_us = (GetCurrentTimeNs() - start) / 1000;
+    printf("%-20s %8lu us %6lu MB/s\n", m.name, elapsed_us,
+           elapsed_us ? size_kib * 1024ul / elapsed_us : 0);
+  }
+  exit(0);
+}
@@ -1,6 +1,7 @@
 #include <array>
 #include <cmath>
 #include <cstdlib>
+#include <vector>
 
 #include "../syscall.h"
 
@@ -10,8 +11,9 @@ template <class T> struct Vector3D { T x, y, z; };
 
 template <class T> struct Vector2D { T x, y; };
 
-void DrawObj(uint64_t layer_id);
-void DrawSurface(uint64_t layer_id, int sur);
+void DrawObj();
+void DrawSurface(int sur);
+void FillRectangle(int x, int y, int w, int h, uint32_t color);
 bool Sleep(unsigned long ms);
 
 const int kScale = 50, kMargin = 10;
@@ -36,6 +38,7 @@ const array<uint32_t, kSurface.size()> kColor{0xff0000, 0x00ff00, 0xffff00,
 array<Vector3D<double>, kCube.size()> vert;
 array<double, kSurface.size()> centerz4;
 array<Vector2D<int>, kCube.size()> scr;
+vector<DrawCommand> cmds; // 1 フレーム分の描画命令
 
 extern "C" void main(int argc, char **argv) {
   auto [layer_id, err_openwin] =
@@ -44,9 +47,14 @@ extern "C" void main(int argc, char **argv) {
     exit(err_openwin);
   }
 
+  int num_frames = -1;
+  if (argc >= 2) {
+    num_frames = atoi(argv[1]);
+  }
+
   int thx = 0, thy = 0, thz = 0;
   const double to_rad = 3.14159265358979323 / 0x8000;
-  for (;;) {
+  for (int frame = 0; num_frames < 0 || frame < num_frames; ++frame) {
     // 立方体を X, Y, Z 軸回りに回転
     thx = (thx + 182) & 0xffff;
     thy = (thy + 273) & 0xffff;
@@ -73,10 +81,10 @@ extern "C" void main(int argc, char **argv) {
     }
 
     // 画面を一旦クリアし，立方体を描画
-    SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW, 4, 24, kCanvasSize,
-                            kCanvasSize, 0);
-    DrawObj(layer_id | LAYER_NO_REDRAW);
-    SyscallWinRedraw(layer_id);
+    cmds.clear();
+    FillRectangle(4, 24, kCanvasSize, kCanvasSize, 0);
+    DrawObj();
+    SyscallWinDrawCommands(layer_id, cmds.data(), cmds.size());
     if (Sleep(50)) {
       break;
     }
@@ -86,7 +94,7 @@ extern "C" void main(int argc, char **argv) {
   exit(0);
 }
 
-void DrawObj(uint64_t layer_id) {
+void DrawObj() {
   // オブジェクト座標 vert を スクリーン座標 scr に変換（画面奥が Z+）
   for (int i = 0; i < kCube.size(); i++) {
     const double t = 6 * kScale / (vert[i].z + 8 * kScale);
@@ -109,12 +117,12 @@ void DrawObj(uint64_t layer_id) {
     const auto e0x = v1.x - v0.x, e0y = v1.y - v0.y, // v0 --> v1
         e1x = v2.x - v1.x, e1y = v2.y - v1.y;        // v1 --> v2
     if (e0x * e1y <= e0y * e1x) {
-      DrawSurface(layer_id, sur);
+      DrawSurface(sur);
     }
   }
 }
 
-void DrawSurface(uint64_t layer_id, int sur) {
+void DrawSurface(int sur) {
   const auto &surface = kSurface[sur]; // 描画する面
   int ymin = kCanvasSize, ymax = 0;    // 画面の描画範囲 [ymin, ymax]
   int y2x_up[kCanvasSize], y2x_down[kCanvasSize]; // Y, X 座標の組
@@ -153,11 +161,18 @@ void DrawSurface(uint64_t layer_id, int sur) {
   for (int y = ymin; y <= ymax; y++) {
     int p0x = min(y2x_up[y], y2x_down[y]);
     int p1x = max(y2x_up[y], y2x_down[y]);
-    SyscallWinFillRectangle(layer_id, 4 + p0x, 24 + y, p1x - p0x + 1, 1,
-                            kColor[sur]);
+    FillRectangle(4 + p0x, 24 + y, p1x - p0x + 1, 1, kColor[sur]);
   }
 }
 
+void FillRectangle(int x, int y, int w, int h, uint32_t color) {
+  DrawCommand cmd;
+  cmd.type = DrawCommand::kFillRectangle;
+  cmd.color = color;
+  cmd.arg.fill = {x, y, w, h};
+  cmds.push_back(cmd);
+}
+
 bool Sleep(unsigned long ms) {
   static unsigned long prev_timeout = 0;
   if (prev_timeout == 0) {
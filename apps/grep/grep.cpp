@@ -3,14 +3,15 @@
 #include <regex>
 
 extern "C" void main(int argc, char **argv) {
-  if (argc < 3) {
-    printf("Usage: %s <pattern> <file>\n", argv[0]);
+  if (argc < 2) {
+    printf("Usage: %s <pattern> [file]\n", argv[0]);
     exit(1);
   }
 
   std::regex pattern(argv[1]);
 
-  FILE *fp = fopen(argv[2], "r");
+  // ファイルを省略したら標準入力（パイプ）から読む
+  FILE *fp = argc >= 3 ? fopen(argv[2], "r") : stdin;
   if (fp == nullptr) {
     printf("falied to open: %s\n", argv[2]);
     exit(1);
@@ -1,20 +1,52 @@
 #include <errno.h>
+#include <reent.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include "pthread.h"
 #include "syscall.h"
 
 int close(int fd) {
-  errno = EBADF;
+  struct SyscallResult res = SyscallCloseFile(fd);
+  if (res.error == 0) {
+    return 0;
+  }
+  errno = res.error;
   return -1;
 }
 
+/* newlib の stdio は st_blksize をバッファの大きさに，
+ * 端末かどうかを行バッファにするかの判断に使う． */
 int fstat(int fd, struct stat *buf) {
-  errno = EBADF;
-  return -1;
+  struct FileStat st;
+  struct SyscallResult res = SyscallStatFile(fd, &st);
+  if (res.error) {
+    errno = res.error;
+    return -1;
+  }
+  memset(buf, 0, sizeof(*buf));
+  buf->st_size = st.size;
+  buf->st_blksize = st.block_size;
+  buf->st_blocks = (st.size + 511) / 512;
+  switch (st.type) {
+  case kDirectory:
+    buf->st_mode = S_IFDIR | 0755;
+    break;
+  case kTerminal:
+    buf->st_mode = S_IFCHR | 0666;
+    break;
+  case kPipe:
+    buf->st_mode = S_IFIFO | 0600;
+    break;
+  default:
+    buf->st_mode = S_IFREG | 0644;
+    break;
+  }
+  return 0;
 }
 
 pid_t getpid() {
@@ -22,8 +54,13 @@ pid_t getpid() {
 }
 
 int isatty(int fd) {
-  errno = EBADF;
-  return -1;
+  struct FileStat st;
+  struct SyscallResult res = SyscallStatFile(fd, &st);
+  if (res.error) {
+    errno = res.error;
+    return 0;
+  }
+  return st.type == kTerminal;
 }
 
 int kill(pid_t pid, int sig) {
@@ -32,7 +69,11 @@ int kill(pid_t pid, int sig) {
 }
 
 off_t lseek(int fd, off_t offset, int whence) {
-  errno = EBADF;
+  struct SyscallResult res = SyscallSeekFile(fd, offset, whence);
+  if (res.error == 0) {
+    return res.value;
+  }
+  errno = res.error;
   return -1;
 }
 
@@ -87,6 +128,24 @@ ssize_t read(int fd, void *buf, size_t count) {
   return -1;
 }
 
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  struct SyscallResult res = SyscallReadFileAt(fd, buf, count, offset);
+  if (res.error == 0) {
+    return res.value;
+  }
+  errno = res.error;
+  return -1;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  struct SyscallResult res = SyscallWriteFileAt(fd, buf, count, offset);
+  if (res.error == 0) {
+    return res.value;
+  }
+  errno = res.error;
+  return -1;
+}
+
 int posix_memalign(void **memptr, size_t alignment, size_t size) {
   void *p = malloc(size + alignment - 1);
   if (!p) {
@@ -96,3 +155,215 @@ int posix_memalign(void **memptr, size_t alignment, size_t size) {
   *memptr = (void *)((addr + alignment - 1) & ~(uintptr_t)(alignment - 1));
   return 0;
 }
+
+/* スレッドのスタックは kThreadStackSize 境界に揃え，その底に struct pthread
+ * を置く．こうすると RSP から自スレッドの情報を求められる． */
+#define kThreadStackSize (64 * 1024)
+#define kMainStackBottom 0xffffffffffffe000ul
+
+struct pthread {
+  uint64_t tid;
+  void *(*start_routine)(void *);
+  void *arg;
+  void *retval;
+  void *block;
+};
+
+static struct pthread main_thread;
+
+pthread_t pthread_self(void) {
+  uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+  if (sp >= kMainStackBottom) {
+    return &main_thread;
+  }
+  return (pthread_t)(sp & ~(uintptr_t)(kThreadStackSize - 1));
+}
+
+static void ThreadEntry(int tid, void *arg) {
+  struct pthread *th = arg;
+  th->retval = th->start_routine(th->arg);
+  SyscallExit(0);
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start_routine)(void *), void *arg) {
+  void *block = malloc(2 * kThreadStackSize);
+  if (!block) {
+    return EAGAIN;
+  }
+  uintptr_t base = ((uintptr_t)block + kThreadStackSize - 1) &
+                   ~(uintptr_t)(kThreadStackSize - 1);
+  struct pthread *th = (struct pthread *)base;
+  th->start_routine = start_routine;
+  th->arg = arg;
+  th->retval = NULL;
+  th->block = block;
+
+  void *stack_top = (void *)(base + kThreadStackSize - 8);
+  struct SyscallResult res = SyscallCreateThread(ThreadEntry, stack_top, th);
+  if (res.error) {
+    free(block);
+    return res.error;
+  }
+  th->tid = res.value;
+  *thread = th;
+  return 0;
+}
+
+int pthread_join(pthread_t thread, void **retval) {
+  struct SyscallResult res = SyscallJoinThread(thread->tid);
+  if (res.error) {
+    return res.error;
+  }
+  if (retval) {
+    *retval = thread->retval;
+  }
+  free(thread->block);
+  return 0;
+}
+
+void pthread_exit(void *retval) {
+  pthread_t self = pthread_self();
+  if (self == &main_thread) {
+    exit(0);
+  }
+  self->retval = retval;
+  SyscallExit(0);
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex,
+                       const pthread_mutexattr_t *attr) {
+  mutex->state = 0;
+  return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) {
+  return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  uint32_t c = 0;
+  if (__atomic_compare_exchange_n(&mutex->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                  __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  if (c != 2) {
+    c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+  }
+  while (c != 0) {
+    SyscallFutexWait(&mutex->state, 2, 0);
+    c = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+  }
+  return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  uint32_t c = 0;
+  if (__atomic_compare_exchange_n(&mutex->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                  __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  return EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  if (__atomic_fetch_sub(&mutex->state, 1, __ATOMIC_RELEASE) != 1) {
+    __atomic_store_n(&mutex->state, 0, __ATOMIC_RELEASE);
+    SyscallFutexWake(&mutex->state, 1);
+  }
+  return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+  cond->seq = 0;
+  return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond) {
+  return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(mutex);
+  SyscallFutexWait(&cond->seq, seq, 0);
+  pthread_mutex_lock(mutex);
+  return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond) {
+  __atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+  SyscallFutexWake(&cond->seq, 1);
+  return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+  __atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+  SyscallFutexWake(&cond->seq, 0x7fffffff);
+  return 0;
+}
+
+/* newlib の malloc を複数スレッドから使えるようにする */
+static pthread_mutex_t malloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t malloc_owner;
+static int malloc_depth;
+
+void __malloc_lock(struct _reent *reent) {
+  pthread_t self = pthread_self();
+  if (malloc_owner == self) {
+    ++malloc_depth;
+    return;
+  }
+  pthread_mutex_lock(&malloc_mutex);
+  malloc_owner = self;
+  malloc_depth = 1;
+}
+
+void __malloc_unlock(struct _reent *reent) {
+  if (--malloc_depth == 0) {
+    malloc_owner = NULL;
+    pthread_mutex_unlock(&malloc_mutex);
+  }
+}
+
+/* 時刻のページは seqlock で守られている．書き換え中（seq が奇数）か，
+ * 読んでいる間に seq が変わったら読み直す． */
+static void ReadTimePage(uint64_t *tick, uint64_t *tick_tsc, uint64_t *tsc) {
+  const struct TimePage *tp = (const struct TimePage *)TIME_PAGE_ADDR;
+  for (;;) {
+    const uint32_t seq = tp->seq;
+    if (seq & 1) {
+      continue;
+    }
+    *tick = tp->tick;
+    *tick_tsc = tp->tick_tsc;
+    *tsc = __builtin_ia32_rdtsc();
+    if (tp->seq == seq) {
+      return;
+    }
+  }
+}
+
+uint64_t GetCurrentTimeNs(void) {
+  const struct TimePage *tp = (const struct TimePage *)TIME_PAGE_ADDR;
+  uint64_t tick, tick_tsc, tsc;
+  ReadTimePage(&tick, &tick_tsc, &tsc);
+
+  const uint64_t ns_per_tick = 1000000000ul / tp->timer_freq;
+  uint64_t ns = tsc > tick_tsc
+                    ? (unsigned __int128)(tsc - tick_tsc) * tp->tsc_to_ns >> 32
+                    : 0;
+  // 割り込みが遅れても次の tick の時刻を追い越さないようにする
+  if (ns >= ns_per_tick) {
+    ns = ns_per_tick - 1;
+  }
+  return tick * ns_per_tick + ns;
+}
+
+struct SyscallResult GetCurrentTick(void) {
+  const struct TimePage *tp = (const struct TimePage *)TIME_PAGE_ADDR;
+  uint64_t tick, tick_tsc, tsc;
+  ReadTimePage(&tick, &tick_tsc, &tsc);
+  struct SyscallResult res = {tick, (int)tp->timer_freq};
+  return res;
+}
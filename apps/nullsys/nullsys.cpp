@@ -0,0 +1,49 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../syscall.h"
+
+// ほとんど何もしないシステムコールの往復にかかる時間を測る．
+// 古いカーネルでも同じバイナリで比べられるように GetCurrentTick を使う．
+// -t を付けると，時刻のページを読む場合の時間も測る
+extern "C" int main(int argc, char **argv) {
+  int count = 1000000;
+  if (argc >= 2) {
+    count = atoi(argv[1]);
+  }
+  const bool time_page = argc >= 3 && strcmp(argv[2], "-t") == 0;
+  if (count < 1) {
+    printf("Usage: nullsys [count] [-t]\n");
+    exit(1);
+  }
+
+  // 1 回目はページフォールトなどが混ざるので計測しない
+  SyscallGetCurrentTick();
+
+  const auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+  const unsigned long tsc_start = __builtin_ia32_rdtsc();
+  for (int i = 0; i < count; ++i) {
+    SyscallGetCurrentTick();
+  }
+  const unsigned long tsc_end = __builtin_ia32_rdtsc();
+  const auto tick_end = SyscallGetCurrentTick().value;
+
+  const unsigned long elapsed_ms = (tick_end - tick_start) * 1000 / timer_freq;
+  printf("%d syscalls in %lu ms: %lu ns/call, %lu cycles/call\n", count,
+         elapsed_ms, elapsed_ms * 1000000 / count,
+         (tsc_end - tsc_start) / count);
+
+  if (time_page) {
+    const uint64_t ns_start = GetCurrentTimeNs();
+    const unsigned long tsc_start = __builtin_ia32_rdtsc();
+    for (int i = 0; i < count; ++i) {
+      GetCurrentTick();
+    }
+    const unsigned long tsc_end = __builtin_ia32_rdtsc();
+    const uint64_t ns_end = GetCurrentTimeNs();
+    printf("%d time page reads: %lu ns/call, %lu cycles/call\n", count,
+           (ns_end - ns_start) / count, (tsc_end - tsc_start) / count);
+  }
+  exit(0);
+}
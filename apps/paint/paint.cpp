@@ -1,14 +1,55 @@
 #include "../syscall.h"
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
-static const int kWidth = 200, kHeight = 130;
+static const int kWidth = 200, kHeight = 130, kMaxEvents = 64;
 
 bool IsInside(int x, int y) {
   return 4 <= x && x < 4 + kWidth && 24 <= y && y < 24 + kHeight;
 }
 
+// リングに溜まったイベントをシステムコールなしで読む．
+// 空ならドアベルを頼んでから FutexWait で待つ
+SyscallResult ReadEventRing(AppEventRing *ring, AppEvent *events, size_t len) {
+  for (;;) {
+    const uint32_t tail = ring->tail;
+    size_t n = ring->head - tail;
+    if (n > 0) {
+      n = n < len ? n : len;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      for (size_t i = 0; i < n; ++i) {
+        events[i] = ring->events[(tail + i) % APP_EVENT_RING_SIZE];
+      }
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      ring->tail = tail + n;
+      return {n, 0};
+    }
+
+    ring->doorbell = 1;
+    // doorbell の書き込みより先に head を読まないようにする
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ring->head != tail) {
+      ring->doorbell = 0;
+      continue;
+    }
+    auto [_, err] =
+        SyscallFutexWait(const_cast<uint32_t *>(&ring->doorbell), 1, 0);
+    if (err && err != EAGAIN) {
+      return {0, err};
+    }
+  }
+}
+
+DrawCommand Line(int x0, int y0, int x1, int y1) {
+  DrawCommand cmd;
+  cmd.type = DrawCommand::kDrawLine;
+  cmd.color = 0x000000;
+  cmd.arg.line = {x0, y0, x1, y1};
+  return cmd;
+}
+
 extern "C" int main(int argc, char **argv) {
   auto [layer_id, err_openwin] =
       SyscallOpenWindow(kWidth + 8, kHeight + 28, 10, 10, "paint");
@@ -16,30 +57,46 @@ extern "C" int main(int argc, char **argv) {
     exit(err_openwin);
   }
 
-  AppEvent events[1];
-  bool press = false;
-  while (true) {
-    auto [n, err] = SyscallReadEvent(events, 1);
+  // リングが使えなければ ReadEvent で読む
+  AppEventRing *ring = nullptr;
+  if (auto [addr, err] = SyscallOpenEventRing(); !err) {
+    ring = reinterpret_cast<AppEventRing *>(addr);
+  }
+
+  AppEvent events[kMaxEvents];
+  DrawCommand cmds[kMaxEvents];
+  bool press = false, quit = false;
+  while (!quit) {
+    auto [n, err] = ring ? ReadEventRing(ring, events, kMaxEvents)
+                         : SyscallReadEvent(events, kMaxEvents);
     if (err) {
       printf("ReadEvent failed: %s\n", strerror(err));
       break;
     }
-    if (events[0].type == AppEvent::kQuit) {
-      break;
-    } else if (events[0].type == AppEvent::kMouseMove) {
-      auto &arg = events[0].arg.mouse_move;
-      const auto prev_x = arg.x - arg.dx, prev_y = arg.y - arg.dy;
-      if (press && IsInside(prev_x, prev_y) && IsInside(arg.x, arg.y)) {
-        SyscallWinDrawLine(layer_id, prev_x, prev_y, arg.x, arg.y, 0x000000);
-      }
-    } else if (events[0].type == AppEvent::kMouseButton) {
-      auto &arg = events[0].arg.mouse_button;
-      if (arg.button == 0) {
-        press = arg.press;
-        SyscallWinFillRectangle(layer_id, arg.x, arg.y, 1, 1, 0x000000);
+
+    // 読んだ分の描画はまとめて 1 回のシステムコールで行う
+    size_t num_cmds = 0;
+    for (size_t i = 0; i < n && !quit; ++i) {
+      if (events[i].type == AppEvent::kQuit) {
+        quit = true;
+      } else if (events[i].type == AppEvent::kMouseMove) {
+        auto &arg = events[i].arg.mouse_move;
+        const auto prev_x = arg.x - arg.dx, prev_y = arg.y - arg.dy;
+        if (press && IsInside(prev_x, prev_y) && IsInside(arg.x, arg.y)) {
+          cmds[num_cmds++] = Line(prev_x, prev_y, arg.x, arg.y);
+        }
+      } else if (events[i].type == AppEvent::kMouseButton) {
+        auto &arg = events[i].arg.mouse_button;
+        if (arg.button == 0) {
+          press = arg.press;
+          cmds[num_cmds++] = Line(arg.x, arg.y, arg.x, arg.y);
+        }
+      } else {
+        printf("unknown event: type = %d\n", events[i].type);
       }
-    } else {
-      printf("unknown event: type = %d\n", events[0].type);
+    }
+    if (num_cmds > 0) {
+      SyscallWinDrawCommands(layer_id, cmds, num_cmds);
     }
   }
 
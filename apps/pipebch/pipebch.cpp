@@ -0,0 +1,108 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../pthread.h"
+#include "../syscall.h"
+
+static const char *kSrc = "pbsrc";
+
+struct Writer {
+  int fd;
+  size_t chunk;
+  size_t total;
+};
+
+void *WriteChunks(void *arg) {
+  const auto w = reinterpret_cast<Writer *>(arg);
+  std::vector<char> buf(w->chunk, 'p');
+  for (size_t rest = w->total; rest > 0;) {
+    const size_t len = rest < w->chunk ? rest : w->chunk;
+    const ssize_t bytes = write(w->fd, buf.data(), len);
+    if (bytes <= 0) {
+      break;
+    }
+    rest -= bytes;
+  }
+  close(w->fd);
+  return nullptr;
+}
+
+// ユーザのバッファを通さずに，ファイルのクラスタからパイプへ写す
+void *SpliceFile(void *arg) {
+  const auto w = reinterpret_cast<Writer *>(arg);
+  const int src = open(kSrc, O_RDONLY);
+  while (SyscallCopyFileRange(src, w->fd, 1ul << 30).value > 0) {
+  }
+  close(src);
+  close(w->fd);
+  return nullptr;
+}
+
+// 書き込み側のスレッドが閉じるまで読み出したバイト数を返す
+size_t Run(void *(*writer)(void *), size_t chunk, size_t total) {
+  int fds[2];
+  if (auto [ret, err] = SyscallCreatePipe(fds); err) {
+    printf("failed to create a pipe: %s\n", strerror(err));
+    exit(1);
+  }
+  Writer w{fds[1], chunk, total};
+  pthread_t thread;
+  pthread_create(&thread, nullptr, writer, &w);
+
+  std::vector<char> buf(chunk);
+  size_t received = 0;
+  ssize_t bytes;
+  while ((bytes = read(fds[0], buf.data(), buf.size())) > 0) {
+    received += bytes;
+  }
+  pthread_join(thread, nullptr);
+  close(fds[0]);
+  return received;
+}
+
+// パイプの転送速度を書き込みの大きさごとに測る
+extern "C" int main(int argc, char **argv) {
+  const int size_mib = argc >= 2 ? atoi(argv[1]) : 16;
+  if (size_mib < 1) {
+    printf("Usage: pipebch [MiB]\n");
+    exit(1);
+  }
+  const size_t total = size_mib * 1024ul * 1024;
+
+  const int fd = open(kSrc, O_WRONLY | O_CREAT | O_TRUNC);
+  if (fd < 0) {
+    printf("failed to create %s: %s\n", kSrc, strerror(errno));
+    exit(1);
+  }
+  std::vector<char> chunk(64 * 1024, 's');
+  for (size_t written = 0; written < total; written += chunk.size()) {
+    write(fd, chunk.data(), chunk.size());
+  }
+  close(fd);
+  printf("%d MiB\n", size_mib);
+
+  const struct {
+    const char *name;
+    void *(*writer)(void *);
+    size_t chunk;
+  } methods[] = {
+      {"write 512B", WriteChunks, 512},
+      {"write 4KiB", WriteChunks, 4096},
+      {"write 64KiB", WriteChunks, 64 * 1024},
+      {"copy_file_range", SpliceFile, 64 * 1024},
+  };
+  for (const auto &m : methods) {
+    const uint64_t start = GetCurrentTimeNs();
+    const size_t received = Run(m.writer, m.chunk, total);
+    const uint64_t elapsed_us = (GetCurrentTimeNs() - start) / 1000;
+    printf("%-20s %8lu us %6lu MB/s%s\n", m.name, elapsed_us,
+           elapsed_us ? received / elapsed_us : 0,
+           received == total ? "" : " (short)");
+  }
+  exit(0);
+}
@@ -0,0 +1,82 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../syscall.h"
+
+static const char *kSrc = "ptsrc";
+static const char *kOther = "ptother";
+static const size_t kSize = 8192; // パイプの容量に収まる大きさ
+
+void WriteFile(const char *path, char c) {
+  const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+  if (fd < 0) {
+    printf("failed to open %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  char buf[1024];
+  memset(buf, c, sizeof(buf));
+  for (size_t written = 0; written < kSize; written += sizeof(buf)) {
+    write(fd, buf, sizeof(buf));
+  }
+  close(fd);
+}
+
+// 元のファイルは書き換えるだけか，切り詰めてクラスタを他のファイルに使わせる
+void Rewrite() {
+  WriteFile(kSrc, 'B');
+}
+
+void TruncateAndReuse() {
+  close(open(kSrc, O_WRONLY | O_TRUNC));
+  WriteFile(kOther, 'C');
+}
+
+// copy_file_range でパイプに入れた後に元のファイルを変えても，
+// 読み出すのは入れた時点の内容であることを確かめる
+bool Check(const char *name, void (*modify)()) {
+  WriteFile(kSrc, 'A');
+  int fds[2];
+  if (auto [ret, err] = SyscallCreatePipe(fds); err) {
+    printf("failed to create a pipe: %s\n", strerror(err));
+    exit(1);
+  }
+
+  const int src = open(kSrc, O_RDONLY);
+  auto [copied, err] = SyscallCopyFileRange(src, fds[1], kSize);
+  close(src);
+  close(fds[1]);
+  if (err || copied != kSize) {
+    printf("%-20s NG: copied %lu bytes (%s)\n", name, copied, strerror(err));
+    close(fds[0]);
+    return false;
+  }
+
+  modify();
+
+  char buf[1024];
+  size_t total = 0, mismatch = 0;
+  ssize_t bytes;
+  while ((bytes = read(fds[0], buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < bytes; ++i) {
+      mismatch += buf[i] != 'A';
+    }
+    total += bytes;
+  }
+  close(fds[0]);
+
+  const bool ok = total == kSize && mismatch == 0;
+  printf("%-20s %s: read %lu bytes, %lu changed\n", name, ok ? "ok" : "NG",
+         total, mismatch);
+  return ok;
+}
+
+extern "C" int main(int argc, char **argv) {
+  bool ok = true;
+  ok &= Check("rewrite", Rewrite);
+  ok &= Check("truncate and reuse", TruncateAndReuse);
+  exit(ok ? 0 : 1);
+}
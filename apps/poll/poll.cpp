@@ -0,0 +1,46 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "../syscall.h"
+
+// 標準入力，イベント（タイマ），タイムアウトのうち先に来たものを表示する．
+// q を入力するか Ctrl-Q で終わる
+extern "C" int main(int argc, char **argv) {
+  const int timeout_ms = argc >= 2 ? atoi(argv[1]) : 1000;
+  const int timer_ms = argc >= 3 ? atoi(argv[2]) : 2500;
+
+  SyscallCreateTimer(TIMER_ONESHOT_REL, 1, timer_ms);
+
+  PollFD fds[2] = {{0, POLLIN, 0}, {POLL_EVENTS_FD, POLLIN, 0}};
+  while (true) {
+    const uint64_t start = GetCurrentTimeNs();
+    auto [n, err] = SyscallPoll(fds, 2, timeout_ms * 1000000l);
+    const uint64_t elapsed_us = (GetCurrentTimeNs() - start) / 1000;
+    if (err) {
+      printf("Poll failed: %s\n", strerror(err));
+      exit(1);
+    }
+
+    if (n == 0) {
+      printf("timeout after %lu us\n", elapsed_us);
+    } else if (fds[0].revents & POLLIN) {
+      char c;
+      if (read(0, &c, 1) <= 0 || c == 'q') {
+        break;
+      }
+      printf(" <- stdin after %lu us\n", elapsed_us);
+    } else if (fds[1].revents & POLLIN) {
+      AppEvent event;
+      SyscallReadEvent(&event, 1);
+      if (event.type == AppEvent::kQuit) {
+        break;
+      } else if (event.type == AppEvent::kTimerTimeout) {
+        printf("timer after %lu us\n", elapsed_us);
+        SyscallCreateTimer(TIMER_ONESHOT_REL, 1, timer_ms);
+      }
+    }
+  }
+  exit(0);
+}
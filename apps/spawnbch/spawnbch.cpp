@@ -0,0 +1,47 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "../syscall.h"
+
+int SpawnAndWait(const char *const *argv) {
+  const auto spawn = SyscallSpawn(argv[0], argv, nullptr);
+  if (spawn.error) {
+    printf("failed to spawn %s: %d\n", argv[0], spawn.error);
+    exit(1);
+  }
+  const auto wait = SyscallWaitApp(spawn.value);
+  if (wait.error) {
+    printf("failed to wait %s: %d\n", argv[0], wait.error);
+    exit(1);
+  }
+  return wait.value;
+}
+
+extern "C" int main(int argc, char **argv) {
+  int count = 10000;
+  if (argc >= 2) {
+    count = atoi(argv[1]);
+  }
+  if (count < 1) {
+    printf("Usage: spawnbch [count]\n");
+    exit(1);
+  }
+
+  const char *const child_argv[] = {"true", nullptr};
+  // 1 回目でイメージがキャッシュされるので，2 回目以降を計測する
+  SpawnAndWait(child_argv);
+
+  const auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+  for (int i = 0; i < count; ++i) {
+    if (int ret = SpawnAndWait(child_argv)) {
+      printf("true exited with %d\n", ret);
+      exit(1);
+    }
+  }
+  const auto tick_end = SyscallGetCurrentTick().value;
+
+  const unsigned long elapsed_ms = (tick_end - tick_start) * 1000 / timer_freq;
+  printf("%d spawns in %lu ms: %lu us/spawn\n", count, elapsed_ms,
+         elapsed_ms * 1000 / count);
+  exit(0);
+}
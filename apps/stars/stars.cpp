@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include <random>
+#include <vector>
 
 #include "../syscall.h"
 
@@ -21,15 +22,16 @@ extern "C" int main(int argc, char **argv) {
 
   auto [tick_start, timer_freq] = SyscallGetCurrentTick();
 
+  // 星ごとにシステムコールを呼ばず，描画命令を溜めて一度に送る
+  std::vector<DrawCommand> cmds(num_stars);
   std::default_random_engine rand_engine;
   std::uniform_int_distribution x_dist(0, kWidth - 2), y_dist(0, kHeight - 2);
-  for (int i = 0; i < num_stars; ++i) {
-    int x = x_dist(rand_engine);
-    int y = y_dist(rand_engine);
-    SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW, 4 + x, 24 + y, 2, 2,
-                            0xfff00);
+  for (auto &cmd : cmds) {
+    cmd.type = DrawCommand::kFillRectangle;
+    cmd.color = 0xfff00;
+    cmd.arg.fill = {4 + x_dist(rand_engine), 24 + y_dist(rand_engine), 2, 2};
   }
-  SyscallWinRedraw(layer_id);
+  SyscallWinDrawCommands(layer_id, cmds.data(), cmds.size());
 
   auto tick_end = SyscallGetCurrentTick();
   printf("%d stars in %lu ms.\n", num_stars,
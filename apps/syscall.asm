@@ -27,3 +27,23 @@ define_syscall OpenFile, 0x8000000c
 define_syscall ReadFile, 0x8000000d
 define_syscall DemandPages, 0x8000000e
 define_syscall MapFile, 0x8000000f
+define_syscall FutexWait, 0x80000010
+define_syscall FutexWake, 0x80000011
+define_syscall CreateThread, 0x80000012
+define_syscall JoinThread, 0x80000013
+define_syscall Spawn, 0x80000014
+define_syscall WaitApp, 0x80000015
+define_syscall WinDrawCommands, 0x80000016
+define_syscall OpenEventRing, 0x80000017
+define_syscall AsyncRead, 0x80000018
+define_syscall AsyncWrite, 0x80000019
+define_syscall Poll, 0x8000001a
+define_syscall CloseFile, 0x8000001b
+define_syscall SeekFile, 0x8000001c
+define_syscall StatFile, 0x8000001d
+define_syscall ReadFileAt, 0x8000001e
+define_syscall WriteFileAt, 0x8000001f
+define_syscall ReadFileV, 0x80000020
+define_syscall WriteFileV, 0x80000021
+define_syscall CopyFileRange, 0x80000022
+define_syscall CreatePipe, 0x80000023
@@ -9,7 +9,12 @@ extern "C" {
 #endif
 
 #include "../kernel/app_event.hpp"
+#include "../kernel/draw_command.hpp"
+#include "../kernel/file_stat.hpp"
+#include "../kernel/io_vec.hpp"
 #include "../kernel/logger.hpp"
+#include "../kernel/poll_fd.hpp"
+#include "../kernel/time_page.hpp"
 
 struct SyscallResult {
   uint64_t value;
@@ -46,6 +51,51 @@ struct SyscallResult SyscallOpenFile(const char *path, int flags);
 struct SyscallResult SyscallReadFile(int fd, void *buf, size_t count);
 struct SyscallResult SyscallDemandPages(size_t num_pages, int flags);
 struct SyscallResult SyscallMapFile(int fd, size_t *file_size, int flags);
+struct SyscallResult SyscallFutexWait(uint32_t *addr, uint32_t expected,
+                                      unsigned long timeout_ms);
+struct SyscallResult SyscallFutexWake(uint32_t *addr, int num_waiters);
+struct SyscallResult SyscallCreateThread(void (*entry)(int, void *),
+                                         void *stack_top, void *arg);
+struct SyscallResult SyscallJoinThread(uint64_t thread_id);
+// argv と fds（標準入出力にする 3 つの fd）は NULL なら省略できる
+struct SyscallResult SyscallSpawn(const char *path, const char *const *argv,
+                                  const int *fds);
+struct SyscallResult SyscallWaitApp(uint64_t app_id);
+// 描画命令をまとめて実行する．value は実行できた命令の数
+struct SyscallResult SyscallWinDrawCommands(uint64_t layer_id_flags,
+                                            const struct DrawCommand *cmds,
+                                            size_t num_cmds);
+// value は struct AppEventRing のアドレス．以後イベントはリングに届く
+struct SyscallResult SyscallOpenEventRing();
+// すぐに要求の ID を返し，完了は AppEvent の kIOComplete で届く
+struct SyscallResult SyscallAsyncRead(int fd, void *buf, size_t count);
+struct SyscallResult SyscallAsyncWrite(int fd, const void *buf, size_t count);
+// value は準備のできた fds の要素の数．timeout_ns が負なら無期限に待つ
+struct SyscallResult SyscallPoll(struct PollFD *fds, size_t nfds,
+                                 int64_t timeout_ns);
+struct SyscallResult SyscallCloseFile(int fd);
+// whence は SEEK_SET，SEEK_CUR，SEEK_END．value は移動後の位置
+struct SyscallResult SyscallSeekFile(int fd, int64_t offset, int whence);
+struct SyscallResult SyscallStatFile(int fd, struct FileStat *st);
+// 以下の 2 つは fd の位置を使わず，変えもしない
+struct SyscallResult SyscallReadFileAt(int fd, void *buf, size_t count,
+                                       size_t offset);
+struct SyscallResult SyscallWriteFileAt(int fd, const void *buf, size_t count,
+                                        size_t offset);
+struct SyscallResult SyscallReadFileV(int fd, const struct IOVec *iov,
+                                      int iovcnt);
+struct SyscallResult SyscallWriteFileV(int fd, const struct IOVec *iov,
+                                       int iovcnt);
+// カーネルの中で fd_in から fd_out へ写す．value は写したバイト数で，
+// 0 なら fd_in の末尾に達している．fd_out がパイプならクラスタから直接写す
+struct SyscallResult SyscallCopyFileRange(int fd_in, int fd_out, size_t count);
+// fds[0] が読み込み側，fds[1] が書き込み側になる
+struct SyscallResult SyscallCreatePipe(int fds[2]);
+
+// 時刻のページを読むので，以下はシステムコールを使わない
+uint64_t GetCurrentTimeNs(void); // 起動してからの時間
+// SyscallGetCurrentTick と同じく value に tick，error に周波数を返す
+struct SyscallResult GetCurrentTick(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "../pthread.h"
+#include "../syscall.h"
+
+static constexpr unsigned long kLimit = 2'000'000;
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long num_primes = 0;
+
+struct Range {
+  unsigned long begin, end;
+};
+
+bool IsPrime(unsigned long n) {
+  if (n < 2) {
+    return false;
+  }
+  for (unsigned long d = 2; d * d <= n; ++d) {
+    if (n % d == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void *CountPrimes(void *arg) {
+  const auto range = reinterpret_cast<Range *>(arg);
+  unsigned long count = 0;
+  for (unsigned long n = range->begin; n < range->end; ++n) {
+    count += IsPrime(n);
+  }
+
+  pthread_mutex_lock(&mutex);
+  num_primes += count;
+  pthread_mutex_unlock(&mutex);
+  return nullptr;
+}
+
+extern "C" int main(int argc, char **argv) {
+  int num_threads = 4;
+  if (argc >= 2) {
+    num_threads = atoi(argv[1]);
+  }
+  if (num_threads < 1 || num_threads > 16) {
+    printf("Usage: threads [1-16]\n");
+    exit(1);
+  }
+
+  pthread_t threads[16];
+  Range ranges[16];
+  auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+  for (int i = 0; i < num_threads; ++i) {
+    ranges[i] = {kLimit * i / num_threads, kLimit * (i + 1) / num_threads};
+    if (int err =
+            pthread_create(&threads[i], nullptr, CountPrimes, &ranges[i])) {
+      printf("failed to create thread: %d\n", err);
+      exit(1);
+    }
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    pthread_join(threads[i], nullptr);
+  }
+  auto tick_end = SyscallGetCurrentTick();
+
+  printf("%lu primes below %lu with %d threads in %lu ms.\n", num_primes,
+         kLimit, num_threads,
+         (tick_end.value - tick_start) * 1000 / timer_freq);
+  exit(0);
+}
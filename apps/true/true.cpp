@@ -0,0 +1,5 @@
+#include <cstdlib>
+
+extern "C" int main(int argc, char **argv) {
+  exit(0);
+}
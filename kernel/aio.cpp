@@ -0,0 +1,90 @@
+#include "aio.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+const size_t kMaxAsyncIO = 64; // アプリごとの処理待ちの要求の上限
+
+void TaskAsyncIO(uint64_t task_id, int64_t data) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  auto &proc = task.Proc();
+
+  // アプリと同じアドレス空間で動くので，アプリのバッファを直接読み書きできる
+  while (!task.ExitRequested()) {
+    if (proc.aio_queue.empty()) {
+      proc.aio_submit.Wait(task);
+      continue;
+    }
+    const auto req = std::move(proc.aio_queue.front());
+    proc.aio_queue.pop_front();
+    __asm__("sti");
+
+    void *buf = reinterpret_cast<void *>(req.buf);
+    Message msg{Message::kAsyncIO};
+    msg.arg.async_io.id = req.id;
+    msg.arg.async_io.result = req.write ? req.fd->Write(buf, req.count)
+                                        : req.fd->Read(buf, req.count);
+    msg.arg.async_io.error = 0;
+    task_manager->SendMessage(req.task_id, msg);
+    __asm__("cli");
+  }
+
+  // 終了するアプリの要求は完了を知らせずに捨てる
+  proc.aio_queue.clear();
+  proc.aio_worker = 0;
+  proc.threads.erase(
+      std::find(proc.threads.begin(), proc.threads.end(), task_id));
+  proc.thread_exit.WakeUp(std::numeric_limits<int>::max());
+  task_manager->Finish();
+}
+
+// 割り込み禁止で呼ぶ
+Error StartWorker(Task &task) {
+  auto &proc = task.Proc();
+  if (proc.aio_worker != 0) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  Task &worker =
+      task_manager->NewTask().InitContext(TaskAsyncIO, 0).ShareProcess(task);
+  if (!worker.Stack().Valid()) {
+    task_manager->Discard(worker);
+    return MAKE_ERROR(Error::kNoEnoughMemory);
+  }
+  proc.aio_worker = worker.ID();
+  proc.threads.push_back(worker.ID());
+  task_manager->Wakeup(&worker);
+  return MAKE_ERROR(Error::kSuccess);
+}
+} // namespace
+
+WithError<uint64_t> SubmitAsyncIO(Task &task, bool write, int fd, uint64_t buf,
+                                  size_t count) {
+  auto &files = task.Files();
+  if (fd < 0 || files.size() <= fd || !files[fd]) {
+    return {0, MAKE_ERROR(Error::kInvalidFile)};
+  }
+  if (!write && !files[fd]->AsyncReadable()) {
+    return {0, MAKE_ERROR(Error::kNotImplemented)};
+  }
+
+  __asm__("cli");
+  auto &proc = task.Proc();
+  if (proc.aio_queue.size() >= kMaxAsyncIO) {
+    __asm__("sti");
+    return {0, MAKE_ERROR(Error::kFull)};
+  }
+  if (auto err = StartWorker(task)) {
+    __asm__("sti");
+    return {0, err};
+  }
+
+  const uint64_t id = proc.aio_next_id++;
+  proc.aio_queue.push_back(
+      AsyncIORequest{id, task.ID(), write, files[fd], buf, count});
+  proc.aio_submit.WakeUp(1);
+  __asm__("sti");
+  return {id, MAKE_ERROR(Error::kSuccess)};
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "task.hpp"
+
+// 非同期 I/O の要求を受け付け，その ID を返す．要求はアプリごとの
+// スレッドが順に処理し，完了は kAsyncIO メッセージで task に届く
+WithError<uint64_t> SubmitAsyncIO(Task &task, bool write, int fd, uint64_t buf,
+                                  size_t count);
@@ -13,6 +13,7 @@ struct AppEvent {
     kMouseButton,
     kTimerTimeout,
     kKeyPush,
+    kIOComplete,
   } type;
 
   union {
@@ -36,9 +37,28 @@ struct AppEvent {
       char ascii;
       int press; // 1: press, 0: release
     } keypush;
+    struct {
+      uint64_t id;     // AsyncRead/AsyncWrite の返した値
+      uint64_t result; // 読み書きしたバイト数
+      int error;
+    } io;
   } arg;
 };
 
+#define APP_EVENT_RING_SIZE 256
+
+// OpenEventRing でアプリの空間に写されるイベントのリング．
+// カーネルが head を進め，アプリが tail を進める
+struct AppEventRing {
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  // アプリが待つ前に 1 にし，カーネルはそれを見て 0 に戻して FutexWake する
+  volatile uint32_t doorbell;
+  volatile uint32_t dropped; // リングが一杯で捨てたイベントの数
+  uint32_t reserved[12];
+  struct AppEvent events[APP_EVENT_RING_SIZE];
+};
+
 #ifdef __cplusplus
 }
 #endif
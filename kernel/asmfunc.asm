@@ -102,6 +102,64 @@ GetCR3:
   mov rax, cr3
   ret
 
+global GetCR4 ; uint64_t GetCR4()
+GetCR4:
+  mov rax, cr4
+  ret
+
+global SetCR4 ; void SetCR4(uint64_t value)
+SetCR4:
+  mov cr4, rdi
+  ret
+
+global SetXCR0 ; void SetXCR0(uint64_t value)
+SetXCR0:
+  mov eax, edi
+  mov rdx, rdi
+  shr rdx, 32
+  xor ecx, ecx
+  xsetbv
+  ret
+
+global ReadTSC ; uint64_t ReadTSC()
+ReadTSC:
+  rdtsc
+  shl rdx, 32
+  or rax, rdx
+  ret
+
+extern ext_state_mode
+
+global SaveExtendedState ; void SaveExtendedState(void *area)
+SaveExtendedState: ; RAX, RDX を破壊する
+  movzx eax, byte [ext_state_mode]
+  test eax, eax
+  jz .fxsave
+  cmp eax, 1
+  mov eax, 0xffffffff
+  mov edx, eax
+  je .xsave
+  xsaveopt [rdi]
+  ret
+.xsave:
+  xsave [rdi]
+  ret
+.fxsave:
+  fxsave [rdi]
+  ret
+
+global RestoreExtendedState ; void RestoreExtendedState(void *area)
+RestoreExtendedState: ; RAX, RDX を破壊する
+  cmp byte [ext_state_mode], 0
+  je .fxrstor
+  mov eax, 0xffffffff
+  mov edx, eax
+  xrstor [rdi]
+  ret
+.fxrstor:
+  fxrstor [rdi]
+  ret
+
 global SwitchContext ; void SwitchContext(void *next_ctx, void *current_ctx)
 SwitchContext:
   mov [rsi + 0x40], rax
@@ -140,7 +198,10 @@ SwitchContext:
   mov dx, gs
   mov [rsi + 0x38], rdx
 
-  fxsave [rsi + 0xc0]
+  push rdi
+  mov rdi, [rsi + 0xc0]
+  call SaveExtendedState
+  pop rdi
   ; fall through to RestoreContext
 
 global RestoreContext
@@ -151,10 +212,18 @@ RestoreContext: ; void RestoreContext(void *task_context);
   push qword [rdi + 0x20] ; CS
   push qword [rdi + 0x08] ; RIP
 
-  fxrstor [rdi + 0xc0]
+  push rdi
+  mov rdi, [rdi + 0xc0]
+  call RestoreExtendedState
+  pop rdi
 
+  ; 同じアドレス空間なら CR3 を書き換えず TLB を保つ
   mov rax, [rdi + 0x00]
+  mov rcx, cr3
+  cmp rax, rcx
+  je .cr3_loaded
   mov cr3, rax
+.cr3_loaded:
   mov rax, [rdi + 0x30]
   mov fs, ax
   mov rax, [rdi + 0x38]
@@ -204,71 +273,111 @@ LoadTR: ; void LoadTR(uint16_t sel);
   ret
 
 extern LAPICTimerOnInterrupt
-; void LAPICTimerOnInterrupt(const TaskContext &ctx_stack);
-
-global IntHandlerLAPICTimer
-IntHandlerLAPICTimer: ; void IntHandlerLAPICTimer();
+; TaskSwitch LAPICTimerOnInterrupt(uint64_t cs);
+extern RescheduleOnInterrupt
+; TaskSwitch RescheduleOnInterrupt(uint64_t cs);
+extern GetCurrentTaskContext
+
+; 割り込みから戻る前にタスクを切り替えうるハンドラを定義する
+%macro define_preempt_handler 2 ; ハンドラ名, 切り替え先を決める関数
+global %1
+%1: ; void %1();
   push rbp
   mov rbp, rsp
 
-  ; スタック上に TaskContext 型の構造を構築する
-  sub rsp, 512
-  fxsave [rsp]
-  push r15
-  push r14
-  push r13
-  push r12
-  push r11
-  push r10
-  push r9
-  push r8
-  push qword [rbp]         ; RBP
-  push qword [rbp + 0x20]  ; RSP
+  ; 呼び出し元保存レジスタだけを退避する
+  push rax
+  push rcx
+  push rdx
   push rsi
   push rdi
-  push rdx
-  push rcx
+  push r8
+  push r9
+  push r10
+  push r11
   push rbx
-  push rax
 
-  mov ax, fs
-  mov bx, gs
-  mov rcx, cr3
+  ; 拡張状態は現在のタスクの保存領域へ直接保存する
+  call GetCurrentTaskContext
+  mov rbx, [rax + 0xc0]
+  mov rdi, rbx
+  call SaveExtendedState
 
-  push rbx                 ; GS
-  push rax                 ; FS
-  push qword [rbp + 0x28]  ; SS
-  push qword [rbp + 0x10]  ; CS
-  push rbp                 ; reserved1
-  push qword [rbp + 0x18]  ; RFLAGS
-  push qword [rbp + 0x08]  ; RIP
-  push rcx                 ; CR3
+  mov rdi, [rbp + 0x10]    ; CS
+  call %2
+  test rax, rax            ; RAX = 切り替え前, RDX = 切り替え後のコンテキスト
+  jnz %%switch
 
-  mov rdi, rsp
-  call LAPICTimerOnInterrupt
+  ; タスクを切り替えない場合はそのまま復帰する
+  mov rdi, rbx
+  call RestoreExtendedState
 
-  add rsp, 8*8  ; CR3 から GS までを無視
-  pop rax
   pop rbx
-  pop rcx
-  pop rdx
+  pop r11
+  pop r10
+  pop r9
+  pop r8
   pop rdi
   pop rsi
-  add rsp, 16   ; RSP, RBP を無視
-  pop r8
-  pop r9
-  pop r10
-  pop r11
-  pop r12
-  pop r13
-  pop r14
-  pop r15
-  fxrstor [rsp]
-
-  mov rsp, rbp
+  pop rdx
+  pop rcx
+  pop rax
   pop rbp
   iretq
 
+%%switch:
+  ; 割り込まれたタスクのレジスタを TaskContext へ直接書き込む
+  mov rdi, rdx
+  mov rcx, [rbp - 0x08]
+  mov [rax + 0x40], rcx    ; RAX
+  mov rcx, [rbp - 0x50]
+  mov [rax + 0x48], rcx    ; RBX
+  mov rcx, [rbp - 0x10]
+  mov [rax + 0x50], rcx    ; RCX
+  mov rcx, [rbp - 0x18]
+  mov [rax + 0x58], rcx    ; RDX
+  mov rcx, [rbp - 0x28]
+  mov [rax + 0x60], rcx    ; RDI
+  mov rcx, [rbp - 0x20]
+  mov [rax + 0x68], rcx    ; RSI
+  mov rcx, [rbp + 0x20]
+  mov [rax + 0x70], rcx    ; RSP
+  mov rcx, [rbp]
+  mov [rax + 0x78], rcx    ; RBP
+  mov rcx, [rbp - 0x30]
+  mov [rax + 0x80], rcx    ; R8
+  mov rcx, [rbp - 0x38]
+  mov [rax + 0x88], rcx    ; R9
+  mov rcx, [rbp - 0x40]
+  mov [rax + 0x90], rcx    ; R10
+  mov rcx, [rbp - 0x48]
+  mov [rax + 0x98], rcx    ; R11
+  mov [rax + 0xa0], r12
+  mov [rax + 0xa8], r13
+  mov [rax + 0xb0], r14
+  mov [rax + 0xb8], r15
+
+  mov rcx, cr3
+  mov [rax + 0x00], rcx    ; CR3
+  mov rcx, [rbp + 0x08]
+  mov [rax + 0x08], rcx    ; RIP
+  mov rcx, [rbp + 0x18]
+  mov [rax + 0x10], rcx    ; RFLAGS
+  mov rcx, [rbp + 0x10]
+  mov [rax + 0x20], rcx    ; CS
+  mov rcx, [rbp + 0x28]
+  mov [rax + 0x28], rcx    ; SS
+  mov rcx, fs
+  mov [rax + 0x30], rcx    ; FS
+  mov rcx, gs
+  mov [rax + 0x38], rcx    ; GS
+
+  jmp RestoreContext
+%endmacro
+
+define_preempt_handler IntHandlerLAPICTimer, LAPICTimerOnInterrupt
+define_preempt_handler IntHandlerReschedule, RescheduleOnInterrupt
+
 global WriteMSR ; void WriteMSR(uint32_t msr, uint64_t value);
 WriteMSR:
   mov rdx, rsi
@@ -278,47 +387,67 @@ WriteMSR:
   wrmsr
   ret
 
-extern GetCurrentTaskOSStackPointer
+; percpu.hpp の PerCPU と合わせる
+kPerCPUOSStackPtr equ 0x08
+kPerCPUUserRSP equ 0x10
+
+extern EnterSyscall
+extern LeaveSyscall
 extern syscall_table
+extern num_syscalls
+extern syscall_invalid
+extern syscall_stats_enabled
+extern SyscallWithStats
 global SyscallEntry ; void SyscallEntry();
-SyscallEntry:
+SyscallEntry: ; FMASK により割り込み禁止で入る
+  ; GS を CPU ごとのデータに切り替えて OS 用スタックに移る
+  swapgs
+  mov [gs:kPerCPUUserRSP], rsp
+  mov rsp, [gs:kPerCPUOSStackPtr]
+  mov rsp, [rsp]
+  push qword [gs:kPerCPUUserRSP]
+  swapgs
+
   push rbp
   push rcx
   push r11
-
   push rax
-
-  mov rcx, r10
-  and eax, 0x7fffffff
   mov rbp, rsp
-
   and rsp, 0xfffffffffffffff0
-  push rax
-  push rdx
-  cli
-  call GetCurrentTaskOSStackPointer
-  sti
-  mov rdx, [rsp + 0]
-  mov [rax - 16], rdx
-  mov rdx, [rsp + 8]
-  mov [rax - 8], rdx
 
-  lea rsp, [rax - 16]
-  pop rdx
-  pop rax
-  and rsp, 0xfffffffffffffff0
-
-  call [syscall_table + 8 * eax]
+  call EnterSyscall
+  sti
 
+  mov rax, [rbp]
+  mov rcx, r10
+  and eax, 0x7fffffff
+  cmp rax, [num_syscalls]
+  jae .invalid
+  cmp byte [syscall_stats_enabled], 0
+  jne .stats
+  call [syscall_table + 8 * rax]
+  jmp .return
+.stats:
+  sub rsp, 8
+  push rax ; 第 7 引数
+  call SyscallWithStats
+  jmp .return
+.invalid:
+  call [syscall_invalid]
+
+.return:
   mov rsp, rbp
-
-  pop rsi
-  cmp esi, 0x80000002
+  cmp dword [rsp], 0x80000002
   je .exit
 
+  cli ; IF は sysret で R11 から戻る
+  call LeaveSyscall
+
+  add rsp, 8
   pop r11
   pop rcx
   pop rbp
+  pop rsp
   o64 sysret
 
 .exit:
@@ -15,12 +15,17 @@ void SetCR0(uint64_t value);
 uint64_t GetCR2();
 void SetCR3(uint64_t value);
 uint64_t GetCR3();
+uint64_t GetCR4();
+void SetCR4(uint64_t value);
+void SetXCR0(uint64_t value);
+uint64_t ReadTSC();
 void SwitchContext(void *next_ctx, void *current_ctx);
 void RestoreContext(void *task_context);
 int CallApp(int argc, char **argv, uint16_t ss, uint64_t rip, uint64_t rsp,
             uint64_t *os_stack_ptr);
 void LoadTR(uint16_t sel);
 void IntHandlerLAPICTimer();
+void IntHandlerReschedule();
 void WriteMSR(uint32_t msr, uint64_t value);
 void SyscallEntry();
 void ExitApp(uint64_t rsp, int32_t ret_val);
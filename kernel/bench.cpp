@@ -0,0 +1,303 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "asmfunc.hpp"
+#include "message.hpp"
+#include "percpu.hpp"
+#include "task.hpp"
+#include "terminal.hpp"
+#include "timer.hpp"
+
+namespace {
+struct PingPong {
+  Task *peer;
+  bool done;
+};
+
+void TaskPong(uint64_t task_id, int64_t data) {
+  const auto pp = reinterpret_cast<PingPong *>(data);
+  Task &task = task_manager->CurrentTask();
+  while (true) {
+    __asm__("cli");
+    if (pp->done) {
+      break;
+    }
+    task_manager->Wakeup(pp->peer);
+    task.Sleep();
+    __asm__("sti");
+  }
+  delete pp;
+  task_manager->Finish();
+}
+
+struct LatencyProbe {
+  Task *waiter;
+  uint64_t echo_id; // 計測用に開いたターミナルのタスク
+  int samples;
+  std::array<uint64_t, 256> sent_tsc; // キーコードを通し番号として使う
+  int received;
+  uint64_t total, max;
+  bool done;
+};
+
+LatencyProbe *latency_probe;
+
+// ターミナルがキーをエコーし終えたときに呼ばれる
+void OnKeyEcho(uint64_t task_id, uint8_t keycode) {
+  const auto probe = latency_probe;
+  if (probe == nullptr || task_id != probe->echo_id || probe->done) {
+    return;
+  }
+  const uint64_t latency = ReadTSC() - probe->sent_tsc[keycode];
+  probe->total += latency;
+  probe->max = std::max(probe->max, latency);
+  if (++probe->received == probe->samples) {
+    __asm__("cli");
+    probe->done = true;
+    task_manager->Wakeup(probe->waiter);
+    __asm__("sti");
+  }
+}
+
+std::optional<Message> WaitMessage(Task &task) {
+  while (true) {
+    __asm__("cli");
+    auto msg = task.ReceiveMessage();
+    if (!msg) {
+      task.Sleep();
+      __asm__("sti");
+      continue;
+    }
+    __asm__("sti");
+    return msg;
+  }
+}
+
+// メインタスクの代わりにキー入力を模したメッセージを定期的に送る
+void TaskProbeInjector(uint64_t task_id, int64_t data) {
+  const auto probe = reinterpret_cast<LatencyProbe *>(data);
+  Task &task = task_manager->CurrentTask();
+
+  // 負荷のアプリが起動し終わるのを待つ
+  unsigned long timeout = timer_manager->CurrentTick() + kTimerFreq / 2;
+  for (int i = 0; i < probe->samples; ++i) {
+    __asm__("cli");
+    timer_manager->AddTimer(Timer{timeout, 1, task_id});
+    __asm__("sti");
+    while (WaitMessage(task)->type != Message::kTimerTimeout) {
+    }
+    timeout += 1;
+
+    // 文字と後退を交互に打ち，行が伸び続けないようにする
+    Message msg{Message::kKeyPush};
+    msg.arg.keyboard.keycode = i % probe->sent_tsc.size();
+    msg.arg.keyboard.ascii = i % 2 ? '\b' : 'a';
+    msg.arg.keyboard.press = true;
+    __asm__("cli");
+    probe->sent_tsc[msg.arg.keyboard.keycode] = ReadTSC();
+    task_manager->SendMessage(probe->echo_id, msg);
+    __asm__("sti");
+  }
+  __asm__("cli");
+  task_manager->Finish();
+}
+
+struct IdleWakeupProbe {
+  Task *waiter;
+  int samples;
+  uint64_t total, max;
+  bool done;
+};
+
+// 他に動くタスクがない状態でタイマを待ち，割り込みから起床までを測る
+void TaskIdleWakeupProbe(uint64_t task_id, int64_t data) {
+  const auto probe = reinterpret_cast<IdleWakeupProbe *>(data);
+  Task &task = task_manager->CurrentTask();
+
+  for (int i = 0; i < probe->samples; ++i) {
+    __asm__("cli");
+    timer_manager->AddTimer(
+        Timer{timer_manager->CurrentTick() + 1, 1, task_id});
+    __asm__("sti");
+    while (WaitMessage(task)->type != Message::kTimerTimeout) {
+    }
+    const uint64_t latency = ReadTSC() - timer_manager->TickTSC();
+    probe->total += latency;
+    probe->max = std::max(probe->max, latency);
+  }
+
+  __asm__("cli");
+  probe->done = true;
+  task_manager->Wakeup(probe->waiter);
+  task_manager->Finish();
+}
+
+struct PreemptionProbe {
+  Task *waiter;
+  int target_switches;
+  uint64_t owner, last_tsc, threshold;
+  int switches, ticks;
+  uint64_t switch_total, switch_min, tick_total;
+  int spinners;
+  bool done;
+};
+
+// TSC を読み続け，読み取りの間隔が空いた箇所を割り込みとして数える
+void TaskPreemptionSpinner(uint64_t task_id, int64_t data) {
+  const auto probe = reinterpret_cast<volatile PreemptionProbe *>(data);
+
+  while (probe->switches < probe->target_switches) {
+    const uint64_t now = ReadTSC();
+    const uint64_t gap = now - probe->last_tsc;
+    if (probe->owner != task_id) {
+      if (probe->owner != 0) {
+        ++probe->switches;
+        probe->switch_total += gap;
+        if (gap < probe->switch_min) {
+          probe->switch_min = gap;
+        }
+      }
+      probe->owner = task_id;
+    } else if (gap > probe->threshold) {
+      ++probe->ticks;
+      probe->tick_total += gap;
+    }
+    probe->last_tsc = now;
+  }
+
+  __asm__("cli");
+  if (--probe->spinners == 0) {
+    probe->done = true;
+    task_manager->Wakeup(probe->waiter);
+  }
+  task_manager->Finish();
+}
+} // namespace
+
+ContextSwitchBenchResult BenchContextSwitch(int iterations) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  auto pp = new PingPong{&task, false};
+  Task &pong = task_manager->NewTask().InitContext(
+      TaskPong, reinterpret_cast<int64_t>(pp));
+
+  const uint64_t start = ReadTSC();
+  for (int i = 0; i < iterations; ++i) {
+    __asm__("cli");
+    task_manager->Wakeup(&pong);
+    task.Sleep();
+    __asm__("sti");
+  }
+  const uint64_t end = ReadTSC();
+
+  __asm__("cli");
+  pp->done = true;
+  task_manager->Wakeup(&pong);
+  __asm__("sti");
+
+  return {2 * static_cast<uint64_t>(iterations), end - start};
+}
+
+// 実際にウィンドウを持つターミナルを開き，キー入力のメッセージを送ってから
+// ターミナルがエコーし終えるまでを測る
+WakeupLatencyBenchResult BenchWakeupLatency(int samples, int echo_level) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  // 打った文字はすべて消してから exit で閉じる
+  samples += samples % 2;
+  auto probe = new LatencyProbe{&task, 0, samples};
+  const auto probe_addr = reinterpret_cast<int64_t>(probe);
+  Task &echo = task_manager->NewTask().InitContext(TaskTerminal, 0);
+  probe->echo_id = echo.ID();
+  Task &injector =
+      task_manager->NewTask().InitContext(TaskProbeInjector, probe_addr);
+  __asm__("cli");
+  latency_probe = probe;
+  key_echo_hook = OnKeyEcho;
+  task_manager->Wakeup(&echo, echo_level);
+  task_manager->Wakeup(&injector, TaskManager::kMaxLevel);
+
+  while (!probe->done) {
+    task.Sleep();
+  }
+  key_echo_hook = nullptr;
+  latency_probe = nullptr;
+  __asm__("sti");
+
+  for (const char *p = "exit\n"; *p; ++p) {
+    Message msg{Message::kKeyPush};
+    msg.arg.keyboard.ascii = *p;
+    msg.arg.keyboard.press = true;
+    task_manager->SendMessage(probe->echo_id, msg);
+  }
+
+  const WakeupLatencyBenchResult res{probe->samples, probe->total, probe->max};
+  delete probe;
+  return res;
+}
+
+PreemptionBenchResult BenchPreemption(int switches) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  auto probe = new PreemptionProbe{&task, switches};
+  probe->threshold = tsc_freq / 2000000; // 0.5 us
+  probe->switch_min = UINT64_MAX;
+  probe->spinners = 2;
+  const auto probe_addr = reinterpret_cast<int64_t>(probe);
+
+  // 2 つのスピナーをターミナルより高いレベルで交互に横取りさせる
+  Task *spinners[2];
+  for (auto &spinner : spinners) {
+    spinner = &task_manager->NewTask().InitContext(TaskPreemptionSpinner,
+                                                   probe_addr);
+  }
+  __asm__("cli");
+  for (auto spinner : spinners) {
+    task_manager->Wakeup(spinner, 2);
+  }
+  while (!probe->done) {
+    task.Sleep();
+  }
+  __asm__("sti");
+
+  const PreemptionBenchResult res{probe->switches, probe->switch_total,
+                                  probe->switch_min, probe->ticks,
+                                  probe->tick_total};
+  delete probe;
+  return res;
+}
+
+IdleWakeupBenchResult BenchIdleWakeup(int samples) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  auto probe = new IdleWakeupProbe{&task, samples};
+  Task &waker = task_manager->NewTask().InitContext(
+      TaskIdleWakeupProbe, reinterpret_cast<int64_t>(probe));
+
+  const auto &idle = ThisCPU().idle;
+  __asm__("cli");
+  const uint64_t start = ReadTSC();
+  const uint64_t idle_start = idle.idle_tsc;
+  task_manager->Wakeup(&waker);
+  while (!probe->done) {
+    task.Sleep();
+  }
+  const uint64_t elapsed = ReadTSC() - start;
+  const uint64_t idle_cycles = idle.idle_tsc - idle_start;
+  __asm__("sti");
+
+  const IdleWakeupBenchResult res{probe->samples, probe->total, probe->max,
+                                  elapsed, idle_cycles};
+  delete probe;
+  return res;
+}
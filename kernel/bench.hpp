@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+struct ContextSwitchBenchResult {
+  uint64_t switches;
+  uint64_t cycles;
+};
+
+ContextSwitchBenchResult BenchContextSwitch(int iterations);
+
+struct WakeupLatencyBenchResult {
+  int samples;
+  uint64_t total_cycles, max_cycles;
+};
+
+// echo_level で動くターミナルのキー入力からエコーまでの時間
+WakeupLatencyBenchResult BenchWakeupLatency(int samples, int echo_level);
+// ターミナルがキーをエコーするたびに呼ばれる．latbench だけが設定する
+inline void (*key_echo_hook)(uint64_t task_id, uint8_t keycode);
+
+struct IdleWakeupBenchResult {
+  int samples;
+  uint64_t total_cycles, max_cycles;
+  uint64_t elapsed_cycles, idle_cycles;
+};
+
+IdleWakeupBenchResult BenchIdleWakeup(int samples);
+
+struct PreemptionBenchResult {
+  int switches;
+  uint64_t switch_cycles, min_switch_cycles;
+  int ticks; // タスクを切り替えなかったタイマ割り込み
+  uint64_t tick_cycles;
+};
+
+PreemptionBenchResult BenchPreemption(int switches);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+struct CPUIDResult {
+  uint32_t eax, ebx, ecx, edx;
+};
+
+inline CPUIDResult CPUID(uint32_t leaf, uint32_t subleaf) {
+  CPUIDResult r;
+  __asm__ volatile("cpuid"
+                   : "=a"(r.eax), "=b"(r.ebx), "=c"(r.ecx), "=d"(r.edx)
+                   : "a"(leaf), "c"(subleaf));
+  return r;
+}
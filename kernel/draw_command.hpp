@@ -0,0 +1,39 @@
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#endif
+
+// WinDrawCommands でまとめて描画する命令．座標はウィンドウ内の位置
+struct DrawCommand {
+  enum DrawType {
+    kFillRectangle,
+    kDrawLine,
+    kWriteString,
+    kBlit,
+  } type;
+  uint32_t color; // kBlit では使わない
+
+  union {
+    struct {
+      int x, y, w, h;
+    } fill;
+    struct {
+      int x0, y0, x1, y1;
+    } line;
+    struct {
+      int x, y;
+      const char *s;
+    } text;
+    struct {
+      int x, y, w, h;
+      const uint32_t *pixels; // w * h 個の 0xRRGGBB
+    } blit;
+  } arg;
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -33,6 +33,9 @@ public:
     kInvalidFile,
     kIsDirectory,
     kNoSuchEntry,
+    kValueMismatch,
+    kTimeout,
+    kInterrupted,
     kLastOfCode,
   };
 
@@ -65,6 +68,9 @@ private:
       "kInvalidFile",
       "kIsDirectory",
       "kNoSuchEntry",
+      "kValueMismatch",
+      "kTimeout",
+      "kInterrupted",
   };
   static_assert(Error::Code::kLastOfCode == code_names.size());
 
@@ -0,0 +1,101 @@
+#include "event_ring.hpp"
+
+#include <cstring>
+
+#include "keyboard.hpp"
+#include "memory_manager.hpp"
+#include "paging.hpp"
+#include "task.hpp"
+
+bool ToAppEvent(const Message &msg, AppEvent &event) {
+  switch (msg.type) {
+  case Message::kKeyPush:
+    if (msg.arg.keyboard.keycode == 20 &&
+        msg.arg.keyboard.modifier & (kLControlBitMask | kRControlBitMask)) {
+      event.type = AppEvent::kQuit;
+    } else {
+      event.type = AppEvent::kKeyPush;
+      event.arg.keypush.modifier = msg.arg.keyboard.modifier;
+      event.arg.keypush.keycode = msg.arg.keyboard.keycode;
+      event.arg.keypush.ascii = msg.arg.keyboard.ascii;
+      event.arg.keypush.press = msg.arg.keyboard.press;
+    }
+    return true;
+  case Message::kMouseMove:
+    event.type = AppEvent::kMouseMove;
+    event.arg.mouse_move.x = msg.arg.mouse_move.x;
+    event.arg.mouse_move.y = msg.arg.mouse_move.y;
+    event.arg.mouse_move.dx = msg.arg.mouse_move.dx;
+    event.arg.mouse_move.dy = msg.arg.mouse_move.dy;
+    event.arg.mouse_move.buttons = msg.arg.mouse_move.buttons;
+    return true;
+  case Message::kMouseButton:
+    event.type = AppEvent::kMouseButton;
+    event.arg.mouse_button.x = msg.arg.mouse_button.x;
+    event.arg.mouse_button.y = msg.arg.mouse_button.y;
+    event.arg.mouse_button.press = msg.arg.mouse_button.press;
+    event.arg.mouse_button.button = msg.arg.mouse_button.button;
+    return true;
+  case Message::kTimerTimeout:
+    // 値が負のタイマだけがアプリの作ったもの
+    if (msg.arg.timer.value >= 0) {
+      return false;
+    }
+    event.type = AppEvent::kTimerTimeout;
+    event.arg.timer.timeout = msg.arg.timer.timeout;
+    event.arg.timer.value = -msg.arg.timer.value;
+    return true;
+  case Message::kAsyncIO:
+    event.type = AppEvent::kIOComplete;
+    event.arg.io.id = msg.arg.async_io.id;
+    event.arg.io.result = msg.arg.async_io.result;
+    event.arg.io.error = msg.arg.async_io.error;
+    return true;
+  default:
+    return false;
+  }
+}
+
+WithError<uint64_t> OpenEventRing(Task &task) {
+  if (task.EventRing()) {
+    return {0, MAKE_ERROR(Error::kAlreadyAllocated)};
+  }
+
+  const size_t num_pages = (sizeof(AppEventRing) + 4095) / 4096;
+  auto [frame, err] = memory_manager->Allocate(num_pages);
+  if (err) {
+    return {0, err};
+  }
+  auto ring = reinterpret_cast<AppEventRing *>(frame.Frame());
+  memset(ring, 0, num_pages * 4096);
+
+  // 写したページはアプリの終了時に CleanPageMaps が解放する
+  const uint64_t vaddr = task.FileMapEnd() - num_pages * 4096;
+  if (auto err = MapPhysicalPages(LinearAddress4Level{vaddr}, num_pages,
+                                  reinterpret_cast<uint64_t>(ring))) {
+    memory_manager->Free(frame, num_pages);
+    return {0, err};
+  }
+  task.SetFileMapEnd(vaddr);
+  task_manager->SetEventRing(task, ring);
+  return {vaddr, MAKE_ERROR(Error::kSuccess)};
+}
+
+bool PushEventRing(AppEventRing &ring, const AppEvent &event) {
+  const uint32_t head = ring.head;
+  if (head - ring.tail >= APP_EVENT_RING_SIZE) {
+    ++ring.dropped;
+    return false;
+  }
+  ring.events[head % APP_EVENT_RING_SIZE] = event;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  ring.head = head + 1;
+
+  // head の書き込みより先に doorbell を読まないようにする
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (ring.doorbell == 0) {
+    return false;
+  }
+  ring.doorbell = 0;
+  return true;
+}
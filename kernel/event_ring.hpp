@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#include "app_event.hpp"
+#include "error.hpp"
+#include "message.hpp"
+
+class Task;
+
+// アプリに渡すメッセージなら AppEvent に変換して true を返す
+bool ToAppEvent(const Message &msg, AppEvent &event);
+
+// イベントのリングを確保して task のアドレス空間に写し，その位置を返す．
+// 以後，アプリに渡すメッセージは ReadEvent ではなくリングに届く
+WithError<uint64_t> OpenEventRing(Task &task);
+
+// タスクのロックを持ったまま呼ぶのでメモリを確保しない．
+// アプリが待っていてドアベルを鳴らす必要があれば true を返す
+bool PushEventRing(AppEventRing &ring, const AppEvent &event);
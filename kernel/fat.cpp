@@ -3,9 +3,17 @@
 #include <algorithm>
 #include <cctype>
 #include <cstring>
+#include <tuple>
 #include <utility>
 
+#include "lock.hpp"
+
 namespace {
+// ボリューム全体を 1 つのロックで守る．ページフォールトの処理中に
+// ファイルを読むことがあるので，同じタスクは再帰的に取れる
+LockStats fat_lock_stats{"fat"};
+Mutex *fat_mutex;
+
 std::pair<const char *, bool> NextPathElement(const char *path,
                                               char *path_elem) {
   const char *next_slash = strchr(path, '/');
@@ -27,6 +35,7 @@ void Initialize(void *volume_image) {
   bytes_per_cluster =
       static_cast<unsigned long>(boot_volume_image->bytes_per_sector) *
       boot_volume_image->sectors_per_cluster;
+  fat_mutex = new Mutex{fat_lock_stats};
 }
 
 uintptr_t GetClusterAddr(unsigned long cluster) {
@@ -69,6 +78,7 @@ unsigned long NextCluster(unsigned long cluster) {
 
 std::pair<DirectoryEntry *, bool> FindFile(const char *path,
                                            unsigned long directory_cluster) {
+  MutexGuard guard{*fat_mutex};
   if (path[0] == '/') {
     directory_cluster = boot_volume_image->root_cluster;
     ++path;
@@ -125,6 +135,7 @@ size_t LoadFile(void *buf, size_t len, DirectoryEntry &entry) {
 }
 
 unsigned long AllocateClusterChain(size_t n) {
+  MutexGuard guard{*fat_mutex};
   uint32_t *fat = GetFAT();
   unsigned long first_cluster;
   for (first_cluster = 2;; ++first_cluster) {
@@ -144,8 +155,12 @@ FileDescriptor::FileDescriptor(DirectoryEntry &fat_entry)
     : fat_entry(fat_entry) {}
 
 size_t FileDescriptor::Read(void *buf, size_t len) {
-  if (rd_cluster == 0) {
-    rd_cluster = fat_entry.FirstCluster();
+  MutexGuard guard{*fat_mutex};
+  if (!ReadPositionValid()) {
+    SeekRead();
+  }
+  if (rd_off >= fat_entry.file_size) {
+    return 0;
   }
   uint8_t *buf8 = reinterpret_cast<uint8_t *>(buf);
   len = std::min(len, fat_entry.file_size - rd_off);
@@ -165,14 +180,22 @@ size_t FileDescriptor::Read(void *buf, size_t len) {
   }
 
   rd_off += total;
+  offset = rd_off;
   return total;
 }
 
 size_t FileDescriptor::Write(const void *buf, size_t len) {
+  MutexGuard guard{*fat_mutex};
   auto num_cluster = [](size_t bytes) {
     return (bytes + bytes_per_cluster - 1) / bytes_per_cluster;
   };
 
+  if (len == 0) {
+    return 0;
+  }
+  if (wr_off != offset) {
+    SeekWrite();
+  }
   if (wr_cluster == 0) {
     if (fat_entry.FirstCluster() != 0) {
       wr_cluster = fat_entry.FirstCluster();
@@ -198,7 +221,7 @@ size_t FileDescriptor::Write(const void *buf, size_t len) {
     }
 
     uint8_t *sec = GetSectorByCluster<uint8_t>(wr_cluster);
-    size_t n = std::min(len, bytes_per_cluster - wr_cluster_off);
+    size_t n = std::min(len - total, bytes_per_cluster - wr_cluster_off);
     memcpy(&sec[wr_cluster_off], &buf8[total], n);
     total += n;
 
@@ -206,7 +229,9 @@ size_t FileDescriptor::Write(const void *buf, size_t len) {
   }
 
   wr_off += total;
-  fat_entry.file_size = wr_off;
+  offset = wr_off;
+  // 途中を書き換えたときは縮めない．切り詰めるのは O_TRUNC で開いたとき
+  fat_entry.file_size = std::max<size_t>(fat_entry.file_size, wr_off);
   return total;
 }
 
@@ -216,17 +241,171 @@ size_t FileDescriptor::Size() const {
 
 size_t FileDescriptor::Load(void *buf, size_t len, size_t offset) {
   FileDescriptor fd{fat_entry};
-  fd.rd_off = offset;
+  fd.offset = offset;
+  return fd.Read(buf, len);
+}
+
+size_t FileDescriptor::Store(const void *buf, size_t len, size_t offset) {
+  FileDescriptor fd{fat_entry};
+  fd.offset = offset;
+  return fd.Write(buf, len);
+}
+
+void FileDescriptor::Stat(FileStat &st) const {
+  st.size = fat_entry.file_size;
+  st.block_size = bytes_per_cluster;
+  st.type = fat_entry.attr == Attribute::kDirectory ? FileStat::kDirectory
+                                                    : FileStat::kRegular;
+}
+
+WithError<size_t> FileDescriptor::CopyFrom(FileDescriptor &src, size_t len) {
+  if (&src.fat_entry == &fat_entry) {
+    return {0, MAKE_ERROR(Error::kInvalidFile)};
+  }
+
+  MutexGuard guard{*fat_mutex};
+  if (src.offset >= src.fat_entry.file_size) {
+    return {0, MAKE_ERROR(Error::kSuccess)};
+  }
+  len = std::min(len, src.fat_entry.file_size - src.offset);
+  if (len == 0) {
+    return {0, MAKE_ERROR(Error::kSuccess)};
+  }
+
+  // 書き込み先のチェーンは最初に一度だけ伸ばす
+  ReserveClusters(offset + len);
+  if (!src.ReadPositionValid()) {
+    src.SeekRead();
+  }
+  if (wr_off != offset) {
+    SeekWrite();
+  }
+  if (wr_cluster == 0) {
+    wr_cluster = fat_entry.FirstCluster();
+  }
+
+  size_t total = 0;
+  while (total < len) {
+    if (wr_cluster_off == bytes_per_cluster) {
+      wr_cluster = NextCluster(wr_cluster);
+      wr_cluster_off = 0;
+    }
+    const size_t n =
+        std::min({len - total, bytes_per_cluster - src.rd_cluster_off,
+                  bytes_per_cluster - wr_cluster_off});
+    memcpy(&GetSectorByCluster<uint8_t>(wr_cluster)[wr_cluster_off],
+           &GetSectorByCluster<uint8_t>(src.rd_cluster)[src.rd_cluster_off],
+           n);
+    total += n;
+
+    wr_cluster_off += n;
+    src.rd_cluster_off += n;
+    if (src.rd_cluster_off == bytes_per_cluster) {
+      src.rd_cluster = NextCluster(src.rd_cluster);
+      src.rd_cluster_off = 0;
+    }
+  }
+
+  src.rd_off += total;
+  src.offset = src.rd_off;
+  wr_off += total;
+  offset = wr_off;
+  fat_entry.file_size = std::max<size_t>(fat_entry.file_size, wr_off);
+  return {total, MAKE_ERROR(Error::kSuccess)};
+}
+
+// パイプの空きは FAT のロックを放して待ち，クラスタからリングへの
+// コピーはロックを持ったまま行う．コピーの途中でファイルが書き換えられたり
+// クラスタが再利用されたりしないようにするため
+size_t FileDescriptor::SpliceTo(::FileDescriptor &out, size_t len) {
+  size_t total = 0;
+  while (total < len) {
+    if (!out.WaitSplice()) {
+      break;
+    }
+
+    MutexGuard guard{*fat_mutex};
+    if (!ReadPositionValid()) {
+      SeekRead();
+    }
+    if (rd_off >= fat_entry.file_size) {
+      break;
+    }
+    const size_t n = std::min({len - total, fat_entry.file_size - rd_off,
+                               bytes_per_cluster - rd_cluster_off});
+    const size_t spliced = out.Splice(
+        &GetSectorByCluster<uint8_t>(rd_cluster)[rd_cluster_off], n);
+
+    rd_cluster_off += spliced;
+    if (rd_cluster_off == bytes_per_cluster) {
+      rd_cluster = NextCluster(rd_cluster);
+      rd_cluster_off = 0;
+    }
+    rd_off += spliced;
+    offset = rd_off;
+    total += spliced;
+  }
+  return total;
+}
 
+std::pair<unsigned long, size_t> FileDescriptor::Locate(size_t off) const {
   unsigned long cluster = fat_entry.FirstCluster();
-  while (offset >= bytes_per_cluster) {
-    offset -= bytes_per_cluster;
+  // チェーンがファイルサイズより短くても終端の先はたどらない
+  while (off >= bytes_per_cluster && cluster != 0 &&
+         !IsEndOfClusterchain(cluster)) {
+    off -= bytes_per_cluster;
     cluster = NextCluster(cluster);
   }
+  return {cluster, off};
+}
 
-  fd.rd_cluster = cluster;
-  fd.rd_cluster_off = offset;
-  return fd.Read(buf, len);
+void FileDescriptor::SeekRead() {
+  rd_off = offset;
+  if (offset >= fat_entry.file_size) {
+    // 末尾から先は読めないので，クラスタは次に読むときに探す
+    rd_cluster = 0;
+    rd_cluster_off = 0;
+    return;
+  }
+  std::tie(rd_cluster, rd_cluster_off) = Locate(offset);
+}
+
+// 末尾まで読むと rd_cluster はチェーンの終端を指す
+bool FileDescriptor::ReadPositionValid() const {
+  return rd_off == offset && rd_cluster != 0 &&
+         !IsEndOfClusterchain(rd_cluster);
+}
+
+// wr_cluster は書き込んだ最後のバイトを含むクラスタなので，1 バイト前を探す
+void FileDescriptor::SeekWrite() {
+  if (offset == 0) {
+    wr_cluster = 0;
+    wr_cluster_off = 0;
+  } else {
+    std::tie(wr_cluster, wr_cluster_off) = Locate(offset - 1);
+    ++wr_cluster_off;
+  }
+  wr_off = offset;
+}
+
+void FileDescriptor::ReserveClusters(size_t bytes) {
+  const size_t needed = (bytes + bytes_per_cluster - 1) / bytes_per_cluster;
+  unsigned long cluster = fat_entry.FirstCluster();
+  if (cluster == 0) {
+    cluster = AllocateClusterChain(needed);
+    fat_entry.first_cluster_low = cluster & 0xffff;
+    fat_entry.first_cluster_high = (cluster >> 16) & 0xffff;
+    return;
+  }
+
+  size_t num_clusters = 1;
+  while (!IsEndOfClusterchain(NextCluster(cluster))) {
+    cluster = NextCluster(cluster);
+    ++num_clusters;
+  }
+  if (num_clusters < needed) {
+    ExtendCluster(cluster, needed - num_clusters);
+  }
 }
 
 bool IsEndOfClusterchain(unsigned long cluster) {
@@ -241,6 +420,7 @@ uint32_t *GetFAT() {
 }
 
 unsigned long ExtendCluster(unsigned long eoc_cluster, size_t n) {
+  MutexGuard guard{*fat_mutex};
   uint32_t *fat = GetFAT();
   while (!IsEndOfClusterchain(fat[eoc_cluster])) {
     eoc_cluster = fat[eoc_cluster];
@@ -262,6 +442,7 @@ unsigned long ExtendCluster(unsigned long eoc_cluster, size_t n) {
 }
 
 DirectoryEntry *AllocateEntry(unsigned long dir_cluster) {
+  MutexGuard guard{*fat_mutex};
   while (true) {
     auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
     for (int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); ++i) {
@@ -300,6 +481,7 @@ void SetFileName(DirectoryEntry &entry, const char *name) {
 }
 
 WithError<DirectoryEntry *> CreateFile(const char *path) {
+  MutexGuard guard{*fat_mutex};
   auto parent_dir_cluster = fat::boot_volume_image->root_cluster;
   const char *filename = path;
 
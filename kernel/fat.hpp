@@ -114,14 +114,34 @@ public:
   size_t Write(const void *buf, size_t len) override;
   size_t Size() const override;
   size_t Load(void *buf, size_t len, size_t offset) override;
+  size_t Store(const void *buf, size_t len, size_t offset) override;
+  void Stat(FileStat &st) const override;
+  bool Seekable() const override { return true; }
+  size_t Offset() const override { return offset; }
+  void SetOffset(size_t offset) override { this->offset = offset; }
+  FileDescriptor *FATFile() override { return this; }
+
+  // src の位置から len バイトを，この fd の位置へクラスタ間で直接写す
+  WithError<size_t> CopyFrom(FileDescriptor &src, size_t len);
+  // この fd の位置から len バイトを，ユーザのバッファを通さずに out に写す
+  size_t SpliceTo(::FileDescriptor &out, size_t len);
 
 private:
   DirectoryEntry &fat_entry;
+  size_t offset = 0; // rd_off や wr_off と違えば，読み書きの前に合わせる
   size_t rd_off = 0;
   unsigned long rd_cluster = 0;
   size_t rd_cluster_off = 0;
   size_t wr_off = 0;
   unsigned long wr_cluster = 0;
   size_t wr_cluster_off = 0;
+
+  // off バイト目を含むクラスタと，その中での位置
+  std::pair<unsigned long, size_t> Locate(size_t off) const;
+  void SeekRead();
+  bool ReadPositionValid() const;
+  void SeekWrite();
+  // 先頭から bytes バイトを書けるだけのクラスタを確保しておく
+  void ReserveClusters(size_t bytes);
 };
 } // namespace fat
@@ -2,6 +2,14 @@
 
 #include <cstddef>
 
+#include "file_stat.hpp"
+#include "poll_fd.hpp"
+
+class WaitQueue;
+namespace fat {
+class FileDescriptor;
+}
+
 class FileDescriptor {
 public:
   virtual ~FileDescriptor() = default;
@@ -9,4 +17,30 @@ public:
   virtual size_t Write(const void *buf, size_t len) = 0;
   virtual size_t Size() const = 0;
   virtual size_t Load(void *buf, size_t len, size_t offset) = 0;
+  // Load と対になる，位置を指定した書き込み
+  virtual size_t Store(const void *buf, size_t len, size_t offset) {
+    return 0;
+  }
+  virtual void Stat(FileStat &st) const {
+    st = FileStat{Size(), 0, FileStat::kRegular};
+  }
+  // Seekable なら，Read と Write は Offset の位置から読み書きする
+  virtual bool Seekable() const { return false; }
+  virtual size_t Offset() const { return 0; }
+  virtual void SetOffset(size_t offset) {}
+  // カーネル内のデータをユーザのバッファを通さずに受け取れるか
+  // （パイプの書き込み側）．Splice は眠らずに，今書ける分だけを写す．
+  // 呼び出し側がロックを持っていてもよいように，空きは WaitSplice で待つ
+  virtual bool CanSplice() const { return false; }
+  virtual size_t Splice(const void *data, size_t len) { return 0; }
+  // Splice できる空きができるまで眠る．もう書けなければ false
+  virtual bool WaitSplice() { return false; }
+  // RTTI を使わずに FAT のファイルかを調べる
+  virtual fat::FileDescriptor *FATFile() { return nullptr; }
+  // 非同期 I/O を処理する別のタスクから Read できるか
+  virtual bool AsyncReadable() const { return true; }
+  // 今すぐ読み書きできるかを POLLIN と POLLOUT で返す
+  virtual int PollEvents() { return POLLIN | POLLOUT; }
+  // PollEvents の結果が変わったときに起こされる待ち行列
+  virtual WaitQueue *PollQueue() { return nullptr; }
 };
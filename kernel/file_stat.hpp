@@ -0,0 +1,24 @@
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdint.h>
+#endif
+
+struct FileStat {
+  uint64_t size;
+  uint32_t block_size; // 読み書きに適した大きさ．FAT ならクラスタの大きさ
+  enum FileType {
+    kRegular,
+    kDirectory,
+    kTerminal,
+    kPipe,
+  } type;
+};
+
+#ifdef __cplusplus
+}
+#endif
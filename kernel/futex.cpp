@@ -0,0 +1,63 @@
+#include "futex.hpp"
+
+#include "lock.hpp"
+#include "paging.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+void InitializeFutex() {
+  futex_queues = new std::map<uint64_t, WaitQueue>;
+}
+
+Error FutexWait(uint64_t uaddr, uint32_t expected, unsigned long timeout_ms) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  auto [key, err] = GetWritablePhysicalAddress(uaddr);
+  if (err) {
+    __asm__("sti");
+    return err;
+  }
+
+  // 値の確認と待ち行列への登録の間に FutexWake が割り込まないようにする
+  if (*reinterpret_cast<volatile uint32_t *>(uaddr) != expected) {
+    __asm__("sti");
+    return MAKE_ERROR(Error::kValueMismatch);
+  }
+
+  unsigned long deadline = 0;
+  if (timeout_ms > 0) {
+    deadline = timer_manager->CurrentTick() +
+               (timeout_ms * kTimerFreq + 999) / 1000;
+  }
+
+  const bool woken = (*futex_queues)[key].Wait(task, deadline);
+  // 先に起床した他のタスクが待ち行列を消しているかもしれない
+  if (auto it = futex_queues->find(key);
+      it != futex_queues->end() && it->second.Empty()) {
+    futex_queues->erase(it);
+  }
+  __asm__("sti");
+
+  return woken ? MAKE_ERROR(Error::kSuccess) : MAKE_ERROR(Error::kTimeout);
+}
+
+WithError<int> FutexWake(uint64_t uaddr, int num_waiters) {
+  __asm__("cli");
+  auto [key, err] = GetWritablePhysicalAddress(uaddr);
+  __asm__("sti");
+  if (err) {
+    return {0, err};
+  }
+  return {FutexWakeKey(key, num_waiters), MAKE_ERROR(Error::kSuccess)};
+}
+
+int FutexWakeKey(uint64_t key, int num_waiters) {
+  // 割り込み禁止中にカーネルから呼ばれることもあるので，状態を戻す
+  const uint64_t rflags = SpinLock::SaveIRQ();
+  int num_woken = 0;
+  if (auto it = futex_queues->find(key); it != futex_queues->end()) {
+    num_woken = it->second.WakeUp(num_waiters);
+  }
+  SpinLock::RestoreIRQ(rflags);
+  return num_woken;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+#include "error.hpp"
+#include "wait_queue.hpp"
+
+// キーは物理アドレスなので，共有ページ上の同じ変数を別のタスクからも待てる
+inline std::map<uint64_t, WaitQueue> *futex_queues;
+
+void InitializeFutex();
+Error FutexWait(uint64_t uaddr, uint32_t expected, unsigned long timeout_ms);
+WithError<int> FutexWake(uint64_t uaddr, int num_waiters);
+// 物理アドレスで指定する．カーネルが別のアドレス空間のタスクを起こすのに使う
+int FutexWakeKey(uint64_t key, int num_waiters);
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// オープンアドレス法（線形探査）のハッシュマップ．
+// 要素はすべて 1 つの配列に置くので，reserve() しておけば
+// 割り込み禁止中の insert/find/erase でメモリ確保が起きない
+template <class Key, class T, class Hash = std::hash<Key>> class HashMap {
+public:
+  using value_type = std::pair<Key, T>;
+
+private:
+  struct Slot {
+    bool used{false};
+    value_type value{};
+  };
+
+  template <class SlotPtr, class Value> class Iterator {
+  public:
+    Iterator(SlotPtr slot, SlotPtr end) : slot{slot}, end{end} { Skip(); }
+    Value &operator*() const { return slot->value; }
+    Value *operator->() const { return &slot->value; }
+    Iterator &operator++() {
+      ++slot;
+      Skip();
+      return *this;
+    }
+    bool operator==(const Iterator &rhs) const { return slot == rhs.slot; }
+    bool operator!=(const Iterator &rhs) const { return slot != rhs.slot; }
+
+  private:
+    SlotPtr slot, end;
+    void Skip() {
+      while (slot != end && !slot->used) {
+        ++slot;
+      }
+    }
+    friend HashMap;
+  };
+
+public:
+  using iterator = Iterator<Slot *, value_type>;
+  using const_iterator = Iterator<const Slot *, const value_type>;
+
+  explicit HashMap(size_t capacity = 16) { Rehash(RoundUp(capacity)); }
+
+  size_t size() const { return num_elems; }
+  bool empty() const { return num_elems == 0; }
+
+  iterator begin() { return {slots.data(), slots.data() + slots.size()}; }
+  iterator end() { return MakeIterator(slots.size()); }
+  const_iterator begin() const {
+    return {slots.data(), slots.data() + slots.size()};
+  }
+  const_iterator end() const {
+    return {slots.data() + slots.size(), slots.data() + slots.size()};
+  }
+
+  iterator find(const Key &key) { return MakeIterator(Lookup(key)); }
+  const_iterator find(const Key &key) const {
+    const size_t i = Lookup(key);
+    return {slots.data() + i, slots.data() + slots.size()};
+  }
+  size_t count(const Key &key) const { return Lookup(key) != slots.size(); }
+
+  std::pair<iterator, bool> insert(value_type value) {
+    size_t i = Lookup(value.first);
+    if (i != slots.size()) {
+      return {MakeIterator(i), false};
+    }
+    reserve(num_elems + 1);
+    i = Home(value.first);
+    while (slots[i].used) {
+      i = (i + 1) & mask;
+    }
+    slots[i].used = true;
+    slots[i].value = std::move(value);
+    ++num_elems;
+    return {MakeIterator(i), true};
+  }
+
+  T &operator[](const Key &key) { return insert({key, T{}}).first->second; }
+
+  // 後続の要素を詰めるので削除済みの印は残らない
+  size_t erase(const Key &key) {
+    size_t i = Lookup(key);
+    if (i == slots.size()) {
+      return 0;
+    }
+    for (size_t j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+      const size_t home = Home(slots[j].value.first);
+      // home が (i, j] の外にある要素だけが i に移動できる
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        slots[i].value = std::move(slots[j].value);
+        i = j;
+      }
+    }
+    slots[i].used = false;
+    slots[i].value = value_type{};
+    --num_elems;
+    return 1;
+  }
+
+  void clear() {
+    for (auto &slot : slots) {
+      slot = Slot{};
+    }
+    num_elems = 0;
+  }
+
+  // n 要素まで再確保せずに insert できるようにする
+  void reserve(size_t n) {
+    if (n * 4 > slots.size() * 3) {
+      Rehash(RoundUp(n * 4 / 3 + 1));
+    }
+  }
+
+private:
+  std::vector<Slot> slots;
+  size_t mask{0}, num_elems{0};
+  int shift{64};
+
+  static size_t RoundUp(size_t n) {
+    size_t cap = 8;
+    while (cap < n) {
+      cap *= 2;
+    }
+    return cap;
+  }
+
+  // 連番の ID でも散らばるように黄金比で掛けて上位ビットを使う
+  size_t Home(const Key &key) const {
+    const uint64_t h = static_cast<uint64_t>(Hash{}(key));
+    return (h * 0x9e37'79b9'7f4a'7c15ul) >> shift;
+  }
+
+  size_t Lookup(const Key &key) const {
+    for (size_t i = Home(key); slots[i].used; i = (i + 1) & mask) {
+      if (slots[i].value.first == key) {
+        return i;
+      }
+    }
+    return slots.size();
+  }
+
+  iterator MakeIterator(size_t i) {
+    return {slots.data() + i, slots.data() + slots.size()};
+  }
+
+  void Rehash(size_t capacity) {
+    std::vector<Slot> old_slots(capacity);
+    old_slots.swap(slots);
+    mask = capacity - 1;
+    shift = 64 - __builtin_ctzl(capacity);
+    num_elems = 0;
+    for (auto &slot : old_slots) {
+      if (slot.used) {
+        insert(std::move(slot.value));
+      }
+    }
+  }
+};
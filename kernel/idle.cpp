@@ -0,0 +1,97 @@
+#include "idle.hpp"
+
+#include "asmfunc.hpp"
+#include "cpuid.hpp"
+#include "logger.hpp"
+#include "percpu.hpp"
+#include "task.hpp"
+
+namespace {
+bool has_mwait = false;
+// CPUID.05H:EDX．4 ビットごとに C0, C1, ... のサブステート数
+uint32_t mwait_substates = 0;
+
+int SubStates(int cstate) {
+  return (mwait_substates >> (4 * cstate)) & 0xf;
+}
+
+void Monitor(const volatile void *addr) {
+  __asm__ volatile("monitor" : : "a"(addr), "c"(0), "d"(0));
+}
+
+// sti の直後の命令までは割り込みが入らないので，
+// 確認してから止まるまでの間に割り込みを取りこぼさない
+void SafeMWait(uint32_t hint) {
+  __asm__ volatile("sti\n\tmwait" : : "a"(hint), "c"(0));
+}
+} // namespace
+
+void InitializeIdle() {
+  has_mwait = (CPUID(1, 0).ecx >> 3) & 1;
+  if (!has_mwait || CPUID(0, 0).eax < 5) {
+    Log(kWarn, "MONITOR/MWAIT is not supported: idle with hlt\n");
+    has_mwait = false;
+    return;
+  }
+  mwait_substates = CPUID(5, 0).edx;
+
+  // 報告されている中で最も深い C ステートを使う
+  int deepest = 1;
+  for (int c = 2; c < 8; ++c) {
+    if (SubStates(c) > 0) {
+      deepest = c;
+    }
+  }
+  SetIdleCState(deepest);
+  Log(kInfo, "idle with mwait: C%d (hint %#x, substates %#x)\n", deepest,
+      mwait_hint, mwait_substates);
+}
+
+bool SetIdleCState(int cstate) {
+  if (cstate == 0) {
+    idle_mode = IdleMode::kHlt;
+    return true;
+  }
+  // C1 はサブステートの報告がなくても使える
+  if (!has_mwait || cstate >= 8 || (cstate > 1 && SubStates(cstate) == 0)) {
+    return false;
+  }
+  mwait_hint = (cstate - 1) << 4;
+  idle_mode = IdleMode::kMWait;
+  return true;
+}
+
+int IdleCState() {
+  if (idle_mode == IdleMode::kHlt) {
+    return 0;
+  }
+  return ((mwait_hint >> 4) & 0xf) + 1;
+}
+
+void TaskIdle(uint64_t task_id, int64_t data) {
+  auto &cpu = ThisCPU();
+  while (true) {
+    __asm__("cli");
+    if (cpu.need_resched) {
+      task_manager->Yield();
+      __asm__("sti");
+      continue;
+    }
+
+    ++cpu.idle.entries;
+    const uint64_t start = ReadTSC();
+    if (idle_mode == IdleMode::kMWait) {
+      cpu.polling = true;
+      Monitor(&cpu.need_resched);
+      if (cpu.need_resched) {
+        __asm__("sti");
+      } else {
+        SafeMWait(mwait_hint);
+      }
+      cpu.polling = false;
+    } else {
+      __asm__("sti\n\thlt");
+    }
+    cpu.idle.idle_tsc += ReadTSC() - start;
+  }
+}
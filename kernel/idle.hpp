@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+enum class IdleMode {
+  kHlt,
+  kMWait,
+};
+
+inline IdleMode idle_mode = IdleMode::kHlt;
+// MWAIT の EAX．[7:4] = C ステート - 1, [3:0] = サブステート
+inline uint32_t mwait_hint = 0;
+
+void InitializeIdle();
+// MWAIT で C<cstate> を使う．0 なら hlt に戻す．対応していなければ false
+bool SetIdleCState(int cstate);
+int IdleCState();
+
+void TaskIdle(uint64_t task_id, int64_t data);
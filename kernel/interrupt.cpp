@@ -6,11 +6,14 @@
 #include "asmfunc.hpp"
 #include "font.hpp"
 #include "graphics.hpp"
+#include "kernel_stack.hpp"
 #include "message.hpp"
 #include "paging.hpp"
 #include "segment.hpp"
 #include "task.hpp"
 #include "timer.hpp"
+#include "usb/xhci/xhci.hpp"
+#include "workqueue.hpp"
 #include "x86_descriptor.hpp"
 
 void SetIDTEntry(InterruptDescriptor &desc, InterruptDescriptorAttribute attr,
@@ -27,9 +30,14 @@ void NotifyEndOfInterrupt() {
   *end_of_interrupt = 0;
 }
 
+void SendSelfIPI(uint8_t vector) {
+  volatile auto icr_low = reinterpret_cast<uint32_t *>(0xfee00300);
+  *icr_low = (0b01 << 18) | vector; // 宛先の省略形: 自分自身
+}
+
 namespace {
 __attribute__((interrupt)) void IntHandlerXHCI(InterruptFrame *frame) {
-  task_manager->SendMessage(1, Message{Message::kInterruptXHCI});
+  QueueWork(kWorkQueueUSB, [](uint64_t) { usb::xhci::ProcessEvents(); });
   NotifyEndOfInterrupt();
 }
 
@@ -71,6 +79,7 @@ void KillApp(InterruptFrame *frame) {
 __attribute__((interrupt)) void IntHandlerPF(InterruptFrame *frame,
                                              uint64_t error_code) {
   uint64_t cr2 = GetCR2();
+  task_manager->CurrentTask().CountPageFault();
   if (auto err = HandlePageFault(error_code, cr2); !err) {
     return;
   }
@@ -83,6 +92,22 @@ __attribute__((interrupt)) void IntHandlerPF(InterruptFrame *frame,
   }
 }
 
+__attribute__((interrupt)) void IntHandlerDF(InterruptFrame *frame,
+                                             uint64_t error_code) {
+  const uint64_t cr2 = GetCR2();
+  KillApp(frame);
+  PrintFrame(frame, "#DF");
+  if (kernel_stack_allocator->IsGuardPage(cr2)) {
+    WriteString(*screen_writer, {500, 16 * 4}, "kernel stack overflow",
+                {0, 0, 0});
+    WriteString(*screen_writer, {500, 16 * 5}, "CR2", {0, 0, 0});
+    PrintHex(cr2, 16, {500 + 8 * 4, 16 * 5});
+  }
+  while (true) {
+    __asm__("hlt");
+  }
+}
+
 #define FaultHandlerWithError(fault_name)                                      \
   __attribute__((interrupt)) void IntHandler##fault_name(                      \
       InterruptFrame *frame, uint64_t error_code) {                            \
@@ -111,7 +136,6 @@ FaultHandlerNoError(OF)
 FaultHandlerNoError(BR)
 FaultHandlerNoError(UD)
 FaultHandlerNoError(NM)
-FaultHandlerWithError(DF)
 FaultHandlerWithError(TS)
 FaultHandlerWithError(NP)
 FaultHandlerWithError(SS)
@@ -135,6 +159,10 @@ void InitializeInterrupt() {
       idt[InterruptVector::kLAPICTimer],
       MakeIDTAttr(DescriptorType::kInterruptGate, 0, true, kISTForTimer),
       reinterpret_cast<uint64_t>(IntHandlerLAPICTimer), kKernelCS);
+  SetIDTEntry(
+      idt[InterruptVector::kReschedule],
+      MakeIDTAttr(DescriptorType::kInterruptGate, 0, true, kISTForTimer),
+      reinterpret_cast<uint64_t>(IntHandlerReschedule), kKernelCS);
   set_idt_entry(0, IntHandlerDE);
   set_idt_entry(1, IntHandlerDB);
   set_idt_entry(3, IntHandlerBP);
@@ -142,7 +170,10 @@ void InitializeInterrupt() {
   set_idt_entry(5, IntHandlerBR);
   set_idt_entry(6, IntHandlerUD);
   set_idt_entry(7, IntHandlerNM);
-  set_idt_entry(8, IntHandlerDF);
+  SetIDTEntry(
+      idt[8],
+      MakeIDTAttr(DescriptorType::kInterruptGate, 0, true, kISTForDoubleFault),
+      reinterpret_cast<uint64_t>(IntHandlerDF), kKernelCS);
   set_idt_entry(10, IntHandlerTS);
   set_idt_entry(11, IntHandlerNP);
   set_idt_entry(12, IntHandlerSS);
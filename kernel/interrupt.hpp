@@ -42,6 +42,7 @@ MakeIDTAttr(DescriptorType type, uint8_t descriptor_privilege_level,
 }
 
 const int kISTForTimer = 1;
+const int kISTForDoubleFault = 2;
 
 void SetIDTEntry(InterruptDescriptor &desc, InterruptDescriptorAttribute attr,
                  uint64_t offset, uint16_t segment_selector);
@@ -51,6 +52,7 @@ public:
   enum Number {
     kXHCI = 0x40,
     kLAPICTimer = 0x41,
+    kReschedule = 0x42,
   };
 };
 
@@ -63,5 +65,6 @@ struct InterruptFrame {
 };
 
 void NotifyEndOfInterrupt();
+void SendSelfIPI(uint8_t vector);
 
 void InitializeInterrupt();
@@ -0,0 +1,21 @@
+#pragma once
+
+#ifdef __cplusplus
+#include <cstddef>
+
+extern "C" {
+#else
+#include <stddef.h>
+#endif
+
+// 1 回の ReadFileV / WriteFileV で渡せる要素の数の上限
+#define IOV_MAX 64
+
+struct IOVec {
+  void *base;
+  size_t len;
+};
+
+#ifdef __cplusplus
+}
+#endif
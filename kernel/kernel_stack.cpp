@@ -0,0 +1,97 @@
+#include "kernel_stack.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "logger.hpp"
+#include "paging.hpp"
+
+namespace {
+const size_t kPageBytes = 4096;
+
+size_t StackPages(size_t bytes) {
+  return (bytes + kPageBytes - 1) / kPageBytes;
+}
+} // namespace
+
+WithError<KernelStack> KernelStackAllocator::Allocate(size_t bytes) {
+  const size_t num_pages = StackPages(bytes);
+  if (num_pages == 0 || num_pages > kMaxStackPages) {
+    return {{}, MAKE_ERROR(Error::kIndexOutOfRange)};
+  }
+
+  KernelStack stack{0, num_pages * kPageBytes};
+  if (free_lists[num_pages] != 0) {
+    // 解放済みスタックの先頭 8 バイトに次の空きスタックのアドレスを置いている
+    stack.base = free_lists[num_pages];
+    free_lists[num_pages] = *reinterpret_cast<uint64_t *>(stack.base);
+  } else {
+    // [ガードページ][スタック] の順に並べ，ガードページはマップしない
+    const uint64_t slot_bytes = kPageBytes + stack.bytes;
+    if (next_slot + slot_bytes > kRegionEnd) {
+      return {{}, MAKE_ERROR(Error::kNoEnoughMemory)};
+    }
+    stack.base = next_slot + kPageBytes;
+    if (auto err = SetupKernelPageMaps(LinearAddress4Level{stack.base},
+                                       num_pages)) {
+      return {{}, err};
+    }
+    next_slot += slot_bytes;
+  }
+
+  std::fill_n(reinterpret_cast<uint64_t *>(stack.base),
+              stack.bytes / sizeof(uint64_t), kFillPattern);
+  return {stack, MAKE_ERROR(Error::kSuccess)};
+}
+
+void KernelStackAllocator::Free(const KernelStack &stack) {
+  if (!stack.Valid()) {
+    return;
+  }
+  const size_t num_pages = StackPages(stack.bytes);
+  *reinterpret_cast<uint64_t *>(stack.base) = free_lists[num_pages];
+  free_lists[num_pages] = stack.base;
+}
+
+size_t KernelStackAllocator::HighWaterMark(const KernelStack &stack) const {
+  if (!stack.Valid()) {
+    return 0;
+  }
+  const auto words = reinterpret_cast<const uint64_t *>(stack.base);
+  const size_t num_words = stack.bytes / sizeof(uint64_t);
+  size_t i = 0;
+  while (i < num_words && words[i] == kFillPattern) {
+    ++i;
+  }
+  return (num_words - i) * sizeof(uint64_t);
+}
+
+bool KernelStackAllocator::IsGuardPage(uint64_t addr) const {
+  if (addr < kRegionBegin || next_slot <= addr) {
+    return false;
+  }
+  // 領域内でマップされていないページはガードページ
+  auto table = reinterpret_cast<PageMapEntry *>(GetCR3());
+  const LinearAddress4Level a{addr};
+  for (int level = 4; level >= 1; --level) {
+    const auto &entry = table[a.Part(level)];
+    if (!entry.bits.present) {
+      return true;
+    }
+    table = entry.Pointer();
+  }
+  return false;
+}
+
+void InitializeKernelStack() {
+  kernel_stack_allocator = new KernelStackAllocator;
+
+  // PML4[1] のページ構造をアプリ用 PML4 のコピーより先に作っておく
+  auto [stack, err] =
+      kernel_stack_allocator->Allocate(kDefaultKernelStackBytes);
+  if (err) {
+    Log(kError, "failed to allocate kernel stack: %s\n", err.Name());
+    return;
+  }
+  kernel_stack_allocator->Free(stack);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+const size_t kDefaultKernelStackBytes = 16 * 1024;
+
+struct KernelStack {
+  uint64_t base{0};
+  size_t bytes{0};
+
+  uint64_t Top() const { return base + bytes; }
+  bool Valid() const { return base != 0; }
+};
+
+class KernelStackAllocator {
+public:
+  static const uint64_t kRegionBegin = 0x0000'0080'0000'0000; // PML4[1]
+  static const uint64_t kRegionEnd = 0x0000'0100'0000'0000;
+  static const size_t kMaxStackPages = 64;
+  static const uint64_t kFillPattern = 0x5a5a'5a5a'5a5a'5a5a;
+
+  WithError<KernelStack> Allocate(size_t bytes);
+  void Free(const KernelStack &stack);
+  size_t HighWaterMark(const KernelStack &stack) const;
+  bool IsGuardPage(uint64_t addr) const;
+
+private:
+  uint64_t next_slot{kRegionBegin};
+  std::array<uint64_t, kMaxStackPages + 1> free_lists{};
+};
+
+inline KernelStackAllocator *kernel_stack_allocator;
+
+void InitializeKernelStack();
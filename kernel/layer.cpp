@@ -15,10 +15,7 @@
 #include "timer.hpp"
 
 namespace {
-template <class T, class U> void EraseIf(T &c, const U &pred) {
-  auto it = std::remove_if(c.begin(), c.end(), pred);
-  c.erase(it, c.end());
-}
+LockStats layer_lock_stats{"layer_manager"};
 } // namespace
 
 Layer::Layer(unsigned int id) : id(id) {}
@@ -65,49 +62,116 @@ bool Layer::IsDraggable() const {
   return draggable;
 }
 
+void LayerGrid::Initialize(Vector2D<int> screen_size) {
+  num_cells = {(screen_size.x + kCellSize - 1) / kCellSize,
+               (screen_size.y + kCellSize - 1) / kCellSize};
+  cells.clear();
+  cells.resize(num_cells.x * num_cells.y);
+}
+
+template <class Func> void LayerGrid::ForEachCell(const Layer &layer, Func f) {
+  const auto &win = layer.GetWindow();
+  if (!win) {
+    return;
+  }
+  const auto pos = layer.GetPosition();
+  const auto end = pos + win->Size();
+  const int x0 = std::max(pos.x, 0) / kCellSize;
+  const int y0 = std::max(pos.y, 0) / kCellSize;
+  const int x1 = std::min((end.x - 1) / kCellSize, num_cells.x - 1);
+  const int y1 = std::min((end.y - 1) / kCellSize, num_cells.y - 1);
+  for (int y = y0; y <= y1; ++y) {
+    for (int x = x0; x <= x1; ++x) {
+      f(cells[y * num_cells.x + x]);
+    }
+  }
+}
+
+void LayerGrid::Add(Layer *layer) {
+  ForEachCell(*layer, [layer](auto &cell) { cell.push_back(layer); });
+}
+
+void LayerGrid::Remove(Layer *layer) {
+  ForEachCell(*layer, [layer](auto &cell) {
+    auto it = std::find(cell.begin(), cell.end(), layer);
+    if (it != cell.end()) {
+      *it = cell.back();
+      cell.pop_back();
+    }
+  });
+}
+
+const std::vector<Layer *> &LayerGrid::LayersAt(Vector2D<int> pos) const {
+  const int x = pos.x / kCellSize, y = pos.y / kCellSize;
+  if (pos.x < 0 || pos.y < 0 || x >= num_cells.x || y >= num_cells.y) {
+    return empty_cell;
+  }
+  return cells[y * num_cells.x + x];
+}
+
+LayerManager::LayerManager() : mutex{layer_lock_stats} {
+  layers.reserve(kReservedLayers);
+}
+
 void LayerManager::SetWriter(FrameBuffer *screen) {
+  MutexGuard guard{mutex};
+
   this->screen = screen;
 
   FrameBufferConfig back_config = screen->Config();
   back_config.frame_buffer = nullptr;
   back_buffer.Initialize(back_config);
+
+  grid.Initialize({static_cast<int>(back_config.horizontal_resolution),
+                   static_cast<int>(back_config.vertical_resolution)});
 }
 
 Layer &LayerManager::NewLayer() {
+  MutexGuard guard{mutex};
+
   ++latest_id;
-  return *layers.emplace_back(new Layer{latest_id});
+  auto [it, inserted] =
+      layers.insert({latest_id, std::make_unique<Layer>(latest_id)});
+  return *it->second;
 }
 
 Layer *LayerManager::FindLayer(unsigned int id) {
-  auto pred = [id](const std::unique_ptr<Layer> &elem) {
-    return elem->ID() == id;
-  };
-  auto it = std::find_if(layers.begin(), layers.end(), pred);
+  MutexGuard guard{mutex};
+
+  auto it = layers.find(id);
   if (it == layers.end()) {
     return nullptr;
   }
-  return it->get();
+  return it->second.get();
 }
 
 void LayerManager::Move(unsigned int id, Vector2D<int> new_pos) {
-  auto layer = FindLayer(id);
-  const auto window_size = layer->GetWindow()->Size();
-  const auto old_pos = layer->GetPosition();
-  layer->Move(new_pos);
-  Draw({old_pos, window_size});
-  Draw(id);
+  MutexGuard guard{mutex};
+
+  MoveRelative(id, new_pos - FindLayer(id)->GetPosition());
 }
 
 void LayerManager::MoveRelative(unsigned int id, Vector2D<int> pos_diff) {
+  MutexGuard guard{mutex};
+
   auto layer = FindLayer(id);
   const auto window_size = layer->GetWindow()->Size();
   const auto old_pos = layer->GetPosition();
+  const bool visible = layer->height >= 0;
+  if (visible) {
+    grid.Remove(layer);
+  }
   layer->MoveRelative(pos_diff);
+  if (visible) {
+    grid.Add(layer);
+  }
   Draw({old_pos, window_size});
   Draw(id);
 }
 
 void LayerManager::Draw(const Rectangle<int> &area) const {
+  MutexGuard guard{mutex};
+
   for (auto layer : layer_stack) {
     layer->DrawTo(back_buffer, area);
   }
@@ -119,6 +183,8 @@ void LayerManager::Draw(unsigned int id) const {
 }
 
 void LayerManager::Draw(unsigned int id, Rectangle<int> area) const {
+  MutexGuard guard{mutex};
+
   bool draw = false;
   Rectangle<int> window_area;
   for (auto layer : layer_stack) {
@@ -139,14 +205,27 @@ void LayerManager::Draw(unsigned int id, Rectangle<int> area) const {
 }
 
 void LayerManager::Hide(unsigned int id) {
+  MutexGuard guard{mutex};
+
   auto layer = FindLayer(id);
-  auto pos = std::find(layer_stack.begin(), layer_stack.end(), layer);
-  if (pos != layer_stack.end()) {
-    layer_stack.erase(pos);
+  const int height = layer->height;
+  if (height >= 0) {
+    layer_stack.erase(layer_stack.begin() + height);
+    grid.Remove(layer);
+    layer->height = -1;
+    UpdateHeights(height);
+  }
+}
+
+void LayerManager::UpdateHeights(int from) {
+  for (int h = from; h < layer_stack.size(); ++h) {
+    layer_stack[h]->height = h;
   }
 }
 
 void LayerManager::UpDown(unsigned int id, int new_height) {
+  MutexGuard guard{mutex};
+
   if (new_height < 0) {
     Hide(id);
     return;
@@ -156,59 +235,59 @@ void LayerManager::UpDown(unsigned int id, int new_height) {
   }
 
   auto layer = FindLayer(id);
-  auto old_pos = std::find(layer_stack.begin(), layer_stack.end(), layer);
+  const int old_height = layer->height;
   auto new_pos = layer_stack.begin() + new_height;
 
-  if (old_pos == layer_stack.end()) {
+  if (old_height < 0) {
     layer_stack.insert(new_pos, layer);
+    grid.Add(layer);
+    UpdateHeights(new_height);
     return;
   }
 
   if (new_pos == layer_stack.end()) {
     --new_pos;
   }
-  layer_stack.erase(old_pos);
+  layer_stack.erase(layer_stack.begin() + old_height);
   layer_stack.insert(new_pos, layer);
+  UpdateHeights(std::min(old_height, new_height));
 }
 
 Layer *LayerManager::FindLayerByPosition(Vector2D<int> pos,
                                          unsigned int exclude_id) const {
-  auto pred = [pos, exclude_id](Layer *layer) {
+  MutexGuard guard{mutex};
+
+  // pos を含むセルに重なるレイヤのうち，最も上にあるもの
+  Layer *found = nullptr;
+  for (Layer *layer : grid.LayersAt(pos)) {
     if (layer->ID() == exclude_id) {
-      return false;
+      continue;
     }
-    const auto &win = layer->GetWindow();
-    if (!win) {
-      return false;
+    if (found && layer->height < found->height) {
+      continue;
     }
     const auto win_pos = layer->GetPosition();
-    const auto win_end_pos = win_pos + win->Size();
-    return win_pos.x <= pos.x && pos.x < win_end_pos.x && win_pos.y <= pos.y &&
-           pos.y < win_end_pos.y;
-  };
-  auto it = std::find_if(layer_stack.rbegin(), layer_stack.rend(), pred);
-  if (it == layer_stack.rend()) {
-    return nullptr;
+    const auto win_end_pos = win_pos + layer->GetWindow()->Size();
+    if (win_pos.x <= pos.x && pos.x < win_end_pos.x && win_pos.y <= pos.y &&
+        pos.y < win_end_pos.y) {
+      found = layer;
+    }
   }
-  return *it;
+  return found;
 }
 
 int LayerManager::GetHeight(unsigned int id) {
-  for (int h = 0; h < layer_stack.size(); ++h) {
-    if (layer_stack[h]->ID() == id) {
-      return h;
-    }
-  }
-  return -1;
+  MutexGuard guard{mutex};
+
+  auto layer = FindLayer(id);
+  return layer ? layer->height : -1;
 }
 
 void LayerManager::RemoveLayer(unsigned int id) {
-  Hide(id);
+  MutexGuard guard{mutex};
 
-  auto pred = [id](const std::unique_ptr<Layer> &elem) {
-    return elem->ID() == id;
-  };
-  EraseIf(layers, pred);
+  Hide(id);
+  layers.erase(id);
 }
 
 namespace {
@@ -257,7 +336,8 @@ void InitializeLayer() {
 
   active_layer = new ActiveLayer{*layer_manager};
 
-  layer_task_map = new std::map<unsigned int, uint64_t>;
+  layer_task_map = new HashMap<unsigned int, uint64_t>;
+  layer_task_map->reserve(kReservedLayers);
 }
 
 void ProcessLayerMessage(const Message &msg) {
@@ -285,6 +365,8 @@ void ActiveLayer::SetMouseLayer(unsigned int mouse_layer) {
 }
 
 void ActiveLayer::Activate(unsigned int layer_id) {
+  MutexGuard guard{manager.GetMutex()};
+
   if (active_layer == layer_id) {
     return;
   }
@@ -1,11 +1,12 @@
 #pragma once
 
-#include <map>
 #include <memory>
 #include <vector>
 
 #include "frame_buffer.hpp"
 #include "graphics.hpp"
+#include "hash_map.hpp"
+#include "lock.hpp"
 #include "message.hpp"
 #include "window.hpp"
 
@@ -31,10 +32,33 @@ private:
   Vector2D<int> pos;
   std::shared_ptr<Window> window;
   bool draggable{false};
+  int height{-1}; // layer_stack 内の位置．非表示なら -1
+
+  friend class LayerManager;
+};
+
+// 画面を正方形のセルに分け，セルごとに重なっている表示中のレイヤを記録する
+class LayerGrid {
+public:
+  static const int kCellSize = 64;
+
+  void Initialize(Vector2D<int> screen_size);
+  void Add(Layer *layer);
+  void Remove(Layer *layer);
+  // pos を含むセルに重なるレイヤ
+  const std::vector<Layer *> &LayersAt(Vector2D<int> pos) const;
+
+private:
+  Vector2D<int> num_cells{0, 0};
+  std::vector<std::vector<Layer *>> cells{};
+  std::vector<Layer *> empty_cell{};
+
+  template <class Func> void ForEachCell(const Layer &layer, Func f);
 };
 
 class LayerManager {
 public:
+  LayerManager();
   void SetWriter(FrameBuffer *screen);
   Layer &NewLayer();
 
@@ -53,15 +77,25 @@ public:
 
   void RemoveLayer(unsigned int id);
 
+  // 複数の操作をまとめて行うときや layer_task_map を触るときに取る
+  Mutex &GetMutex() const { return mutex; }
+
 private:
+  mutable Mutex mutex;
   FrameBuffer *screen{nullptr};
   mutable FrameBuffer back_buffer;
 
-  std::vector<std::unique_ptr<Layer>> layers;
+  HashMap<unsigned int, std::unique_ptr<Layer>> layers;
   std::vector<Layer *> layer_stack;
+  LayerGrid grid;
   unsigned int latest_id{0};
+
+  void UpdateHeights(int from);
 };
 
+// この数までのレイヤーなら，layers や layer_task_map の更新でメモリを確保しない
+const size_t kReservedLayers = 64;
+
 inline LayerManager *layer_manager;
 
 void InitializeLayer();
@@ -82,7 +116,7 @@ private:
 };
 
 inline ActiveLayer *active_layer;
-inline std::map<unsigned int, uint64_t> *layer_task_map;
+inline HashMap<unsigned int, uint64_t> *layer_task_map;
 
 constexpr Message MakeLayerMessage(uint64_t task_id, unsigned int layer_id,
                                    LayerOperation op,
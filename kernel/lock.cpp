@@ -0,0 +1,96 @@
+#include "lock.hpp"
+
+#include <algorithm>
+
+#include "asmfunc.hpp"
+#include "task.hpp"
+
+namespace {
+const uint64_t kRFLAGSInterruptEnable = 1u << 9;
+} // namespace
+
+void LockStats::Acquired(bool contended) {
+  if (!registered) {
+    registered = true;
+    next = lock_stats_head;
+    lock_stats_head = this;
+  }
+  ++acquisitions;
+  if (contended) {
+    ++contentions;
+  }
+}
+
+void LockStats::Released(uint64_t acquire_tsc) {
+  max_hold_tsc = std::max(max_hold_tsc, ReadTSC() - acquire_tsc);
+}
+
+uint64_t SpinLock::LockIRQSave() {
+  const uint64_t rflags = SaveIRQ();
+  bool contended = false;
+  while (__atomic_exchange_n(&locked, 1, __ATOMIC_ACQUIRE)) {
+    contended = true;
+    while (locked) {
+      __asm__ volatile("pause");
+    }
+  }
+  stats->Acquired(contended);
+  acquire_tsc = ReadTSC();
+  return rflags;
+}
+
+void SpinLock::Unlock() {
+  stats->Released(acquire_tsc);
+  __atomic_store_n(&locked, 0, __ATOMIC_RELEASE);
+}
+
+uint64_t SpinLock::SaveIRQ() {
+  uint64_t rflags;
+  __asm__ volatile("pushfq\n\tpop %0\n\tcli" : "=r"(rflags) : : "memory");
+  return rflags;
+}
+
+void SpinLock::RestoreIRQ(uint64_t rflags) {
+  if (rflags & kRFLAGSInterruptEnable) {
+    __asm__ volatile("sti" : : : "memory");
+  }
+}
+
+void Mutex::Lock() {
+  // タスク管理の初期化前は他に動くタスクがない
+  if (task_manager == nullptr) {
+    return;
+  }
+
+  const uint64_t rflags = SpinLock::SaveIRQ();
+  Task &task = task_manager->CurrentTask();
+  if (owner == &task) {
+    ++depth;
+    SpinLock::RestoreIRQ(rflags);
+    return;
+  }
+
+  const bool contended = owner != nullptr;
+  while (owner != nullptr) {
+    waiters.Wait(task, 0, false);
+  }
+  owner = &task;
+  depth = 1;
+  stats->Acquired(contended);
+  acquire_tsc = ReadTSC();
+  SpinLock::RestoreIRQ(rflags);
+}
+
+void Mutex::Unlock() {
+  if (task_manager == nullptr) {
+    return;
+  }
+
+  const uint64_t rflags = SpinLock::SaveIRQ();
+  if (--depth == 0) {
+    stats->Released(acquire_tsc);
+    owner = nullptr;
+    waiters.WakeUp(1);
+  }
+  SpinLock::RestoreIRQ(rflags);
+}
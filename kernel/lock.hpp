@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+
+#include "wait_queue.hpp"
+
+class Task;
+
+// ロックの統計情報．同じ種類のロックは 1 つの統計を共有できる
+struct LockStats {
+  const char *name;
+  uint64_t acquisitions{0};
+  uint64_t contentions{0};  // 取得時にすでにロックされていた回数
+  uint64_t max_hold_tsc{0}; // 最長の保持時間
+  LockStats *next{nullptr};
+  bool registered{false};
+
+  constexpr explicit LockStats(const char *name) : name{name} {}
+  void Acquired(bool contended);
+  void Released(uint64_t acquire_tsc);
+};
+
+// 統計情報を登録順にたどる
+template <class Func> void ForEachLockStats(Func f);
+
+// 割り込みを禁止して取るスピンロック
+class SpinLock {
+public:
+  constexpr explicit SpinLock(LockStats &stats) : stats{&stats} {}
+  // 戻り値は取得前の RFLAGS
+  uint64_t LockIRQSave();
+  // 割り込みの状態は変えずにロックだけを解放する
+  void Unlock();
+  // 割り込みを禁止し，禁止する前の RFLAGS を返す
+  static uint64_t SaveIRQ();
+  static void RestoreIRQ(uint64_t rflags);
+
+private:
+  volatile uint32_t locked{0};
+  uint64_t acquire_tsc{0};
+  LockStats *stats;
+};
+
+class SpinLockGuard {
+public:
+  explicit SpinLockGuard(SpinLock &lock)
+      : lock{&lock}, rflags{lock.LockIRQSave()} {}
+  ~SpinLockGuard() {
+    Release();
+    SpinLock::RestoreIRQ(rflags);
+  }
+  SpinLockGuard(const SpinLockGuard &) = delete;
+  SpinLockGuard &operator=(const SpinLockGuard &) = delete;
+
+  // タスク切り替えの前に，割り込み禁止のままロックを解放する
+  void Release() {
+    if (lock) {
+      lock->Unlock();
+      lock = nullptr;
+    }
+  }
+
+private:
+  SpinLock *lock;
+  uint64_t rflags;
+};
+
+// 待つ間は眠るロック．保持中のタスクは同じロックを再帰的に取れる
+class Mutex {
+public:
+  explicit Mutex(LockStats &stats) : stats{&stats} {}
+  void Lock();
+  void Unlock();
+
+private:
+  Task *owner{nullptr};
+  int depth{0};
+  uint64_t acquire_tsc{0};
+  WaitQueue waiters{};
+  LockStats *stats;
+};
+
+class MutexGuard {
+public:
+  explicit MutexGuard(Mutex &mutex) : mutex{mutex} { mutex.Lock(); }
+  ~MutexGuard() { mutex.Unlock(); }
+  MutexGuard(const MutexGuard &) = delete;
+  MutexGuard &operator=(const MutexGuard &) = delete;
+
+private:
+  Mutex &mutex;
+};
+
+inline LockStats *lock_stats_head;
+
+template <class Func> void ForEachLockStats(Func f) {
+  for (auto stats = lock_stats_head; stats; stats = stats->next) {
+    f(*stats);
+  }
+}
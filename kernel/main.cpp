@@ -17,8 +17,11 @@
 #include "font.hpp"
 #include "frame_buffer.hpp"
 #include "frame_buffer_config.hpp"
+#include "futex.hpp"
 #include "graphics.hpp"
+#include "idle.hpp"
 #include "interrupt.hpp"
+#include "kernel_stack.hpp"
 #include "keyboard.hpp"
 #include "layer.hpp"
 #include "logger.hpp"
@@ -38,6 +41,8 @@
 #include "usb/xhci/trb.hpp"
 #include "usb/xhci/xhci.hpp"
 #include "window.hpp"
+#include "workqueue.hpp"
+#include "xsave.hpp"
 
 int printk(const char *format, ...) {
   va_list ap;
@@ -134,8 +139,11 @@ KernelMainNewStack(const FrameBufferConfig &frame_buffer_config_ref,
   InitializeSegmentation();
   InitializePaging();
   InitializeMemoryManager(memory_map);
+  InitializeKernelStack();
   InitializeTSS();
   InitializeInterrupt();
+  InitializeExtendedState();
+  InitializeIdle();
 
   fat::Initialize(volume_image);
   InitializePCI();
@@ -147,6 +155,7 @@ KernelMainNewStack(const FrameBufferConfig &frame_buffer_config_ref,
 
   acpi::Initialize(acpi_table);
   InitializeLAPICTimer();
+  InitializeTimePage();
 
   const int kTextboxCursorTimer = 1;
   const int kTimer05Sec = static_cast<int>(kTimerFreq * 0.5);
@@ -157,12 +166,14 @@ KernelMainNewStack(const FrameBufferConfig &frame_buffer_config_ref,
 
   InitializeTask();
   Task &main_task = task_manager->CurrentTask();
+  InitializeFutex();
+  InitializeWorkQueues();
 
   usb::xhci::Initialize();
   InitializeKeyboard();
   InitializeMouse();
 
-  app_loads = new std::map<fat::DirectoryEntry *, AppLoadInfo>;
+  InitializeAppLoads();
   task_manager->NewTask().InitContext(TaskTerminal, 0).Wakeup();
 
   char str[128];
@@ -189,15 +200,10 @@ KernelMainNewStack(const FrameBufferConfig &frame_buffer_config_ref,
     __asm__("sti");
 
     switch (msg->type) {
-    case Message::kInterruptXHCI:
-      usb::xhci::ProcessEvents();
-      break;
     case Message::kTimerTimeout:
       if (msg->arg.timer.value == kTextboxCursorTimer) {
-        __asm__("cli");
         timer_manager->AddTimer(Timer{msg->arg.timer.timeout + kTimer05Sec,
                                       kTextboxCursorTimer, 1});
-        __asm__("sti");
         textbox_cursor_visible = !textbox_cursor_visible;
         DrawTextCursor(textbox_cursor_visible);
         layer_manager->Draw(text_window_layer_id);
@@ -212,13 +218,10 @@ KernelMainNewStack(const FrameBufferConfig &frame_buffer_config_ref,
                  msg->arg.keyboard.keycode == 59 /* F2 */) {
         task_manager->NewTask().InitContext(TaskTerminal, 0).Wakeup();
       } else {
-        __asm__("cli");
+        MutexGuard guard{layer_manager->GetMutex()};
         auto task_it = layer_task_map->find(act);
-        __asm__("sti");
         if (task_it != layer_task_map->end()) {
-          __asm__("cli");
           task_manager->SendMessage(task_it->second, *msg);
-          __asm__("sti");
         } else {
           printk("key push not handled: keycode %02x, ascii %02x\n",
                  msg->arg.keyboard.keycode, msg->arg.keyboard.ascii);
@@ -227,9 +230,10 @@ KernelMainNewStack(const FrameBufferConfig &frame_buffer_config_ref,
       break;
     case Message::kLayer:
       ProcessLayerMessage(*msg);
-      __asm__("cli");
       task_manager->SendMessage(msg->src_task, Message{Message::kLayerFinish});
-      __asm__("sti");
+      break;
+    case Message::kTaskExit:
+      task_manager->Reap();
       break;
     default:
       Log(kError, "Unknown message type: %d\n", static_cast<int>(msg->type));
@@ -6,7 +6,6 @@ enum class LayerOperation { Move, MoveRelative, Draw, DrawArea };
 
 struct Message {
   enum Type {
-    kInterruptXHCI,
     kTimerTimeout,
     kKeyPush,
     kLayer,
@@ -14,6 +13,9 @@ struct Message {
     kMouseMove,
     kMouseButton,
     kWindowActive,
+    kTaskExit,
+    kAppExit,
+    kAsyncIO,
   } type;
 
   uint64_t src_task;
@@ -48,5 +50,14 @@ struct Message {
     struct {
       bool activate;
     } window_active;
+    struct {
+      int result;
+      bool failed; // 起動に失敗した
+    } app_exit;
+    struct {
+      uint64_t id;
+      uint64_t result;
+      int error;
+    } async_io;
   } arg;
 };
@@ -45,6 +45,7 @@ void SendMouseMessage(Vector2D<int> newpos, Vector2D<int> posdiff,
   if (!act) {
     return;
   }
+  MutexGuard guard{layer_manager->GetMutex()};
   const auto layer = layer_manager->FindLayer(act);
 
   const auto task_it = layer_task_map->find(act);
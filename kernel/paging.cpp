@@ -61,25 +61,36 @@ WithError<PageMapEntry *> SetNewPageMapIfNotPresent(PageMapEntry &entry) {
   return {child_map, MAKE_ERROR(Error::kSuccess)};
 }
 
+// phys を指定すると，新しいページを確保せずにそこから順に割り当てる
 WithError<size_t> SetupPageMap(PageMapEntry *page_map, int page_map_level,
                                LinearAddress4Level addr, size_t num_4kpages,
-                               bool writable) {
+                               bool writable, bool user,
+                               uint64_t *phys = nullptr) {
   while (num_4kpages > 0) {
     const auto entry_index = addr.Part(page_map_level);
 
-    auto [child_map, err] = SetNewPageMapIfNotPresent(page_map[entry_index]);
-    if (err) {
-      return {num_4kpages, err};
+    PageMapEntry *child_map = nullptr;
+    if (page_map_level == 1 && phys) {
+      page_map[entry_index].SetPointer(reinterpret_cast<PageMapEntry *>(*phys));
+      page_map[entry_index].bits.present = 1;
+      *phys += kPageSize4K;
+    } else {
+      auto [new_map, err] = SetNewPageMapIfNotPresent(page_map[entry_index]);
+      if (err) {
+        return {num_4kpages, err};
+      }
+      child_map = new_map;
     }
-    page_map[entry_index].bits.user = 1;
+    page_map[entry_index].bits.user = user;
 
     if (page_map_level == 1) {
       page_map[entry_index].bits.writable = writable;
       --num_4kpages;
     } else {
       page_map[entry_index].bits.writable = true;
-      auto [num_remain_pages, err] = SetupPageMap(child_map, page_map_level - 1,
-                                                  addr, num_4kpages, writable);
+      auto [num_remain_pages, err] =
+          SetupPageMap(child_map, page_map_level - 1, addr, num_4kpages,
+                       writable, user, phys);
       if (err) {
         return {num_4kpages, err};
       }
@@ -154,6 +165,7 @@ Error SetPageContent(PageMapEntry *table, int part, LinearAddress4Level addr,
     const auto i = addr.Part(part);
     table[i].SetPointer(content);
     table[i].bits.writable = 1;
+    table[i].bits.cow = 0;
     InvalidateTLB(addr.value);
     return MAKE_ERROR(Error::kSuccess);
   }
@@ -162,6 +174,19 @@ Error SetPageContent(PageMapEntry *table, int part, LinearAddress4Level addr,
   return SetPageContent(table[i].Pointer(), part - 1, addr, content);
 }
 
+PageMapEntry *FindPageEntry(uint64_t addr) {
+  auto table = reinterpret_cast<PageMapEntry *>(GetCR3());
+  const LinearAddress4Level a{addr};
+  for (int level = 4; level > 1; --level) {
+    const auto &entry = table[a.Part(level)];
+    if (!entry.bits.present) {
+      return nullptr;
+    }
+    table = entry.Pointer();
+  }
+  return &table[a.Part(1)];
+}
+
 Error CopyOnePage(uint64_t causal_addr) {
   auto [p, err] = NewPageMap();
   if (err) {
@@ -177,7 +202,31 @@ Error CopyOnePage(uint64_t causal_addr) {
 Error SetupPageMaps(LinearAddress4Level addr, size_t num_4kpages,
                     bool writable) {
   auto pml4_table = reinterpret_cast<PageMapEntry *>(GetCR3());
-  return SetupPageMap(pml4_table, 4, addr, num_4kpages, writable).error;
+  return SetupPageMap(pml4_table, 4, addr, num_4kpages, writable, true).error;
+}
+
+Error MapPhysicalPages(LinearAddress4Level addr, size_t num_4kpages,
+                       uint64_t phys_addr, bool writable) {
+  auto pml4_table = reinterpret_cast<PageMapEntry *>(GetCR3());
+  const auto err = SetupPageMap(pml4_table, 4, addr, num_4kpages, writable,
+                                true, &phys_addr)
+                       .error;
+  if (err) {
+    // 途中まで写したページを外し，呼び出し側が物理ページを解放できるようにする
+    for (size_t i = 0; i < num_4kpages; ++i) {
+      const uint64_t vaddr = addr.value + i * kPageSize4K;
+      if (auto entry = FindPageEntry(vaddr)) {
+        entry->data = 0;
+        InvalidateTLB(vaddr);
+      }
+    }
+  }
+  return err;
+}
+
+Error SetupKernelPageMaps(LinearAddress4Level addr, size_t num_4kpages) {
+  auto kernel_pml4 = reinterpret_cast<PageMapEntry *>(&pml4_table[0]);
+  return SetupPageMap(kernel_pml4, 4, addr, num_4kpages, true, false).error;
 }
 
 WithError<PageMapEntry *> NewPageMap() {
@@ -212,6 +261,7 @@ Error CopyPageMaps(PageMapEntry *dest, PageMapEntry *src, int part, int start) {
       }
       dest[i] = src[i];
       dest[i].bits.writable = 0;
+      dest[i].bits.cow = 1;
     }
     return MAKE_ERROR(Error::kSuccess);
   }
@@ -239,7 +289,11 @@ Error HandlePageFault(uint64_t error_code, uint64_t causal_addr) {
   const bool rw = (error_code >> 1) & 1;
   const bool user = (error_code >> 2) & 1;
   if (present && rw && user) {
-    return CopyOnePage(causal_addr);
+    // 時刻のページのような本当に読み出し専用のページへの書き込みは失敗させる
+    if (auto entry = FindPageEntry(causal_addr); entry && entry->bits.cow) {
+      return CopyOnePage(causal_addr);
+    }
+    return MAKE_ERROR(Error::kAlreadyAllocated);
   } else if (present) {
     return MAKE_ERROR(Error::kAlreadyAllocated);
   }
@@ -248,7 +302,26 @@ Error HandlePageFault(uint64_t error_code, uint64_t causal_addr) {
     return SetupPageMaps(LinearAddress4Level{causal_addr}, 1);
   }
   if (auto m = FindFileMapping(task.FileMaps(), causal_addr)) {
-    return PreparePageCache(*task.Files()[m->fd], *m, causal_addr);
+    return PreparePageCache(*m->fd, *m, causal_addr);
   }
   return MAKE_ERROR(Error::kIndexOutOfRange);
 }
+
+WithError<uint64_t> GetWritablePhysicalAddress(uint64_t addr) {
+  auto entry = FindPageEntry(addr);
+  if (entry == nullptr || !entry->bits.present) {
+    // 書き込みによる（ユーザモードからの）ページフォルトとして扱う
+    if (auto err = HandlePageFault(0b110, addr)) {
+      return {0, err};
+    }
+    entry = FindPageEntry(addr);
+  }
+  if (!entry->bits.writable) {
+    if (auto err = HandlePageFault(0b111, addr)) {
+      return {0, err};
+    }
+  }
+
+  const auto page = reinterpret_cast<uint64_t>(entry->Pointer());
+  return {page | (addr & 0xfff), MAKE_ERROR(Error::kSuccess)};
+}
@@ -75,7 +75,8 @@ union PageMapEntry {
     uint64_t dirty : 1;
     uint64_t huge_page : 1;
     uint64_t global : 1;
-    uint64_t : 3;
+    uint64_t cow : 1; // OS が使えるビット．書き込み時にコピーする共有ページ
+    uint64_t : 2;
 
     uint64_t addr : 40;
     uint64_t : 12;
@@ -96,5 +97,10 @@ WithError<PageMapEntry *> NewPageMap();
 Error CleanPageMaps(LinearAddress4Level addr);
 Error SetupPageMaps(LinearAddress4Level addr, size_t num_4kpages,
                     bool writable = true);
+// 確保済みの物理ページを現在のアプリの空間に写す．失敗したときは何も写さない
+Error MapPhysicalPages(LinearAddress4Level addr, size_t num_4kpages,
+                       uint64_t phys_addr, bool writable = true);
+Error SetupKernelPageMaps(LinearAddress4Level addr, size_t num_4kpages);
 Error CopyPageMaps(PageMapEntry *dest, PageMapEntry *src, int part, int start);
 Error HandlePageFault(uint64_t error_code, uint64_t causal_addr);
+WithError<uint64_t> GetWritablePhysicalAddress(uint64_t addr);
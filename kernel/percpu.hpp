@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "workqueue.hpp"
+
+class Task;
+
+struct IdleStats {
+  uint64_t entries;   // hlt/mwait を実行した回数
+  uint64_t idle_tsc;  // hlt/mwait で止まっていた TSC カウント
+  uint64_t ipi_saved; // IPI の代わりにメモリ書き込みで起こした回数
+};
+
+// CPU ごとのデータ．need_resched は MWAIT で監視するので
+// 他のデータと同じキャッシュラインに置かないようにする
+struct alignas(64) PerCPU {
+  // 先頭の 3 つは syscall の入口が GS 経由で読み書きする
+  Task *current_task;
+  uint64_t *os_stack_ptr; // 現在のタスクの OS 用スタックを指す変数
+  uint64_t user_rsp;      // syscall の入口でユーザのスタックを退避する
+
+  alignas(64) volatile uint32_t need_resched;
+  alignas(64) volatile bool polling; // MWAIT で need_resched を監視している
+  IdleStats idle;
+  WorkQueue *workqueues[kNumWorkQueues];
+};
+
+// asmfunc.asm の kPerCPUOSStackPtr, kPerCPUUserRSP と合わせる
+static_assert(offsetof(PerCPU, os_stack_ptr) == 0x08);
+static_assert(offsetof(PerCPU, user_rsp) == 0x10);
+
+// AP を起動するまでは BSP だけ
+const int kMaxCPUs = 1;
+inline PerCPU cpus[kMaxCPUs];
+
+inline PerCPU &ThisCPU() {
+  return cpus[0];
+}
@@ -0,0 +1,168 @@
+#include "pipe.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "lock.hpp"
+#include "task.hpp"
+
+namespace {
+const int kWakeAll = std::numeric_limits<int>::max();
+} // namespace
+
+// 割り込み禁止で守るのは位置と数の更新だけにする．ユーザの
+// バッファはページフォルトで FAT のロックを取りうるので，memcpy は
+// 割り込みを許可して行う
+size_t Pipe::Read(void *buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  uint8_t *buf8 = reinterpret_cast<uint8_t *>(buf);
+  Task &task = task_manager->CurrentTask();
+
+  uint64_t rflags = SpinLock::SaveIRQ();
+  while (reading || (queued == 0 && writers > 0)) {
+    if (!readable.Wait(task)) {
+      SpinLock::RestoreIRQ(rflags);
+      return 0;
+    }
+  }
+  reading = true;
+
+  // queued から外すまで，書き込み側はその区間を上書きしない
+  size_t total = 0;
+  while (total < len && queued > 0) {
+    const size_t tail = (ring_head + kCapacity - queued) % kCapacity;
+    const size_t n = std::min({len - total, queued, kCapacity - tail});
+    SpinLock::RestoreIRQ(rflags);
+    memcpy(&buf8[total], &ring[tail], n);
+    rflags = SpinLock::SaveIRQ();
+
+    queued -= n;
+    total += n;
+    writable.WakeUp(kWakeAll);
+  }
+  reading = false;
+  readable.WakeUp(kWakeAll);
+  SpinLock::RestoreIRQ(rflags);
+  return total;
+}
+
+size_t Pipe::Write(const void *buf, size_t len) {
+  return Put(reinterpret_cast<const uint8_t *>(buf), len, true);
+}
+
+size_t Pipe::Splice(const void *data, size_t len) {
+  return Put(reinterpret_cast<const uint8_t *>(data), len, false);
+}
+
+bool Pipe::WaitSplice() {
+  Task &task = task_manager->CurrentTask();
+  const uint64_t rflags = SpinLock::SaveIRQ();
+  while (readers > 0 && (writing || queued == kCapacity)) {
+    if (!writable.Wait(task)) {
+      SpinLock::RestoreIRQ(rflags);
+      return false;
+    }
+  }
+  const bool ok = readers > 0;
+  SpinLock::RestoreIRQ(rflags);
+  return ok;
+}
+
+// block が false なら，空きがなくても他の書き込み中でも眠らずに戻る
+size_t Pipe::Put(const uint8_t *data, size_t len, bool block) {
+  Task &task = task_manager->CurrentTask();
+
+  uint64_t rflags = SpinLock::SaveIRQ();
+  while (writing) {
+    if (!block || readers == 0 || !writable.Wait(task)) {
+      SpinLock::RestoreIRQ(rflags);
+      return 0;
+    }
+  }
+  writing = true;
+  size_t total = 0;
+  while (total < len && readers > 0) {
+    if (queued == kCapacity) {
+      if (!block || !writable.Wait(task)) {
+        break;
+      }
+      continue;
+    }
+
+    // ring_head から先の kCapacity - queued バイトは読み込み側が触らない
+    const size_t n =
+        std::min({len - total, kCapacity - queued, kCapacity - ring_head});
+    uint8_t *dst = &ring[ring_head];
+    SpinLock::RestoreIRQ(rflags);
+    memcpy(dst, &data[total], n);
+    rflags = SpinLock::SaveIRQ();
+
+    ring_head = (ring_head + n) % kCapacity;
+    queued += n;
+    total += n;
+    readable.WakeUp(kWakeAll);
+  }
+  writing = false;
+  writable.WakeUp(kWakeAll);
+  SpinLock::RestoreIRQ(rflags);
+  return total;
+}
+
+PipeFileDescriptor::PipeFileDescriptor(std::shared_ptr<Pipe> pipe,
+                                       bool write_end)
+    : pipe{std::move(pipe)}, write_end{write_end} {
+  const uint64_t rflags = SpinLock::SaveIRQ();
+  ++(write_end ? this->pipe->writers : this->pipe->readers);
+  SpinLock::RestoreIRQ(rflags);
+}
+
+// 最後の書き込み側が閉じたら読み込み側に EOF を，最後の読み込み側が
+// 閉じたら書き込み側に失敗を知らせる
+PipeFileDescriptor::~PipeFileDescriptor() {
+  const uint64_t rflags = SpinLock::SaveIRQ();
+  if (write_end && --pipe->writers == 0) {
+    pipe->readable.WakeUp(kWakeAll);
+  } else if (!write_end && --pipe->readers == 0) {
+    pipe->writable.WakeUp(kWakeAll);
+  }
+  SpinLock::RestoreIRQ(rflags);
+}
+
+size_t PipeFileDescriptor::Read(void *buf, size_t len) {
+  return write_end ? 0 : pipe->Read(buf, len);
+}
+
+size_t PipeFileDescriptor::Write(const void *buf, size_t len) {
+  return write_end ? pipe->Write(buf, len) : 0;
+}
+
+size_t PipeFileDescriptor::Splice(const void *data, size_t len) {
+  return write_end ? pipe->Splice(data, len) : 0;
+}
+
+bool PipeFileDescriptor::WaitSplice() {
+  return write_end && pipe->WaitSplice();
+}
+
+int PipeFileDescriptor::PollEvents() {
+  if (!write_end) {
+    return pipe->queued > 0 || pipe->writers == 0 ? POLLIN : 0;
+  } else if (pipe->readers == 0) {
+    return POLLERR;
+  }
+  return pipe->queued < Pipe::kCapacity ? POLLOUT : 0;
+}
+
+WaitQueue *PipeFileDescriptor::PollQueue() {
+  return write_end ? &pipe->writable : &pipe->readable;
+}
+
+std::pair<std::shared_ptr<::FileDescriptor>, std::shared_ptr<::FileDescriptor>>
+MakePipe() {
+  auto pipe = std::make_shared<Pipe>();
+  return {std::make_shared<PipeFileDescriptor>(pipe, false),
+          std::make_shared<PipeFileDescriptor>(pipe, true)};
+}
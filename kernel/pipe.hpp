@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "file.hpp"
+#include "wait_queue.hpp"
+
+// 読み込み側と書き込み側が共有する，複数ページのリングバッファ．
+// Splice で渡されたデータも書き込みと同じくリングに写すので，
+// 渡した側が後で書き換えても読み込み側には影響しない
+class Pipe {
+public:
+  static const size_t kCapacity = 16 * 4096;
+
+  Pipe() : ring(kCapacity) {}
+  // 中身ができるまで眠る．書き込み側がすべて閉じていれば 0 を返す
+  size_t Read(void *buf, size_t len);
+  // 空きができるまで眠る．読み込み側がすべて閉じていれば途中でやめる
+  size_t Write(const void *buf, size_t len);
+  // 眠らずに，今の空きに収まる分だけを写す
+  size_t Splice(const void *data, size_t len);
+  // Splice できる空きができるまで眠る．読み込み側がなければ false
+  bool WaitSplice();
+
+private:
+  std::vector<uint8_t> ring;
+  size_t ring_head{0}; // 次に書き込む位置．読む位置は queued バイト前
+  size_t queued{0};
+  int readers{0}, writers{0};
+  WaitQueue readable{}, writable{};
+  // ユーザ空間との memcpy は割り込みを許可して行うので，その間に
+  // 他の読み込み側や書き込み側が同じ区間を触らないようにする．
+  // 終了を求められたスレッドが待たずに戻れるよう，Mutex は使わない
+  bool reading{false}, writing{false};
+
+  size_t Put(const uint8_t *data, size_t len, bool block);
+
+  friend class PipeFileDescriptor;
+};
+
+class PipeFileDescriptor : public ::FileDescriptor {
+public:
+  PipeFileDescriptor(std::shared_ptr<Pipe> pipe, bool write_end);
+  ~PipeFileDescriptor() override;
+  size_t Read(void *buf, size_t len) override;
+  size_t Write(const void *buf, size_t len) override;
+  size_t Size() const override { return pipe->queued; }
+  size_t Load(void *buf, size_t len, size_t offset) override { return 0; }
+  void Stat(FileStat &st) const override {
+    st = FileStat{pipe->queued, Pipe::kCapacity, FileStat::kPipe};
+  }
+  int PollEvents() override;
+  WaitQueue *PollQueue() override;
+  bool CanSplice() const override { return write_end; }
+  size_t Splice(const void *data, size_t len) override;
+  bool WaitSplice() override;
+
+private:
+  std::shared_ptr<Pipe> pipe;
+  bool write_end;
+};
+
+// 読み込み側と書き込み側の fd の組を作る
+std::pair<std::shared_ptr<::FileDescriptor>, std::shared_ptr<::FileDescriptor>>
+MakePipe();
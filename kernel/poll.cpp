@@ -0,0 +1,137 @@
+#include "poll.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "event_ring.hpp"
+#include "futex.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+bool AppEventArrived(Task &task) {
+  if (auto ring = task.EventRing()) {
+    return ring->head != ring->tail;
+  }
+  return task_manager->AnyMessage(task, [](const Message &msg) {
+    AppEvent event;
+    return ToAppEvent(msg, event);
+  });
+}
+
+int PollOne(Task &task, const PollFD &pfd) {
+  if (pfd.fd == POLL_EVENTS_FD) {
+    return AppEventArrived(task) ? (pfd.events & POLLIN) : 0;
+  } else if (pfd.fd < 0) {
+    return 0;
+  }
+  auto &files = task.Files();
+  if (pfd.fd >= static_cast<int>(files.size()) || !files[pfd.fd]) {
+    return POLLNVAL;
+  }
+  return files[pfd.fd]->PollEvents() & (pfd.events | POLLERR);
+}
+} // namespace
+
+WithError<int> Poll(Task &task, PollFD *fds, size_t nfds, int64_t timeout_ns) {
+  // ユーザ空間のページフォルトを割り込み禁止中に起こさないよう写しを使う
+  std::vector<PollFD> pfds(fds, fds + nfds);
+
+  // fd ごとの待ち行列と，リングのドアベルの futex で同時に待つ．
+  // 待つ間に別のスレッドが fd を閉じても待ち行列が消えないよう，fd を持っておく
+  std::vector<std::shared_ptr<::FileDescriptor>> files;
+  std::vector<WaitQueue *> queues;
+  for (const auto &pfd : pfds) {
+    if (pfd.fd >= 0 && pfd.fd < static_cast<int>(task.Files().size()) &&
+        task.Files()[pfd.fd]) {
+      if (auto queue = task.Files()[pfd.fd]->PollQueue()) {
+        files.push_back(task.Files()[pfd.fd]);
+        queues.push_back(queue);
+      }
+    }
+  }
+  std::vector<WaitQueue::Waiter> waiters(queues.size(),
+                                         WaitQueue::Waiter{&task, false});
+  AppEventRing *ring = task.EventRing();
+  uint64_t doorbell_key = 0;
+  if (ring) {
+    doorbell_key = reinterpret_cast<uint64_t>(&ring->doorbell);
+  }
+  // futex の待ち行列は空になると FutexWait などが消すので，ポインタは
+  // 持ち越さずに登録するたびに探す
+  WaitQueue::Waiter doorbell_waiter{&task, false};
+
+  __asm__("cli");
+  for (size_t i = 0; i < queues.size(); ++i) {
+    queues[i]->Add(waiters[i]);
+  }
+  if (ring) {
+    (*futex_queues)[doorbell_key].Add(doorbell_waiter);
+  }
+
+  unsigned long deadline = 0;
+  if (timeout_ns > 0) {
+    const int64_t ns_per_tick = 1'000'000'000 / kTimerFreq;
+    deadline = timer_manager->CurrentTick() +
+               (timeout_ns + ns_per_tick - 1) / ns_per_tick;
+    timer_manager->AddTimer(Timer{deadline, kWaitTimerValue, task.ID()});
+  }
+
+  int num_ready = 0;
+  auto err = MAKE_ERROR(Error::kSuccess);
+  while (true) {
+    // 調べた後にリングへ届いたイベントがドアベルを鳴らすようにする
+    if (ring) {
+      ring->doorbell = 1;
+    }
+    num_ready = 0;
+    for (auto &pfd : pfds) {
+      pfd.revents = PollOne(task, pfd);
+      num_ready += pfd.revents != 0;
+    }
+    if (num_ready > 0 || timeout_ns == 0 ||
+        (deadline != 0 && timer_manager->CurrentTick() >= deadline)) {
+      break;
+    }
+    if (task.ExitRequested()) {
+      err = MAKE_ERROR(Error::kInterrupted);
+      break;
+    }
+
+    // WakeUp は待ち行列から外すので，起こされた行列には登録し直す
+    for (size_t i = 0; i < queues.size(); ++i) {
+      if (waiters[i].woken) {
+        waiters[i].woken = false;
+        queues[i]->Add(waiters[i]);
+      }
+    }
+    if (ring && doorbell_waiter.woken) {
+      doorbell_waiter.woken = false;
+      (*futex_queues)[doorbell_key].Add(doorbell_waiter);
+    }
+    task.Sleep();
+  }
+
+  for (size_t i = 0; i < queues.size(); ++i) {
+    queues[i]->Remove(waiters[i]);
+  }
+  if (ring) {
+    if (auto it = futex_queues->find(doorbell_key);
+        it != futex_queues->end()) {
+      it->second.Remove(doorbell_waiter);
+      if (it->second.Empty()) {
+        futex_queues->erase(it);
+      }
+    }
+  }
+  __asm__("sti");
+
+  // 期限前に戻るなら，タイマの通知が後からメッセージとして残らないようにする
+  if (deadline != 0 && timer_manager->CurrentTick() < deadline) {
+    timer_manager->CancelTimer(Timer{deadline, kWaitTimerValue, task.ID()});
+  }
+
+  std::copy(pfds.begin(), pfds.end(), fds);
+  return {num_ready, err};
+}
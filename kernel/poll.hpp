@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+#include "poll_fd.hpp"
+
+class Task;
+
+// 1 回の Poll で待てる要素の数の上限
+const size_t kMaxPollFDs = 64;
+
+// fds のいずれかの準備ができるか timeout_ns が過ぎるまで眠り，revents を
+// 設定して準備のできた要素の数を返す．timeout_ns が負なら無期限に待つ
+WithError<int> Poll(Task &task, PollFD *fds, size_t nfds, int64_t timeout_ns);
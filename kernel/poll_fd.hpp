@@ -0,0 +1,29 @@
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdint.h>
+#endif
+
+// events と revents に使うビット
+#define POLLIN 0x001
+#define POLLOUT 0x004
+#define POLLERR 0x008
+#define POLLNVAL 0x020 // fd が開かれていない
+
+// fd にこの値を指定すると，アプリ宛てのイベント（ReadEvent かイベントの
+// リングで受け取るもの）が届いていれば POLLIN になる
+#define POLL_EVENTS_FD (-2)
+
+struct PollFD {
+  int fd; // 負なら無視する（POLL_EVENTS_FD を除く）
+  uint16_t events;
+  uint16_t revents;
+};
+
+#ifdef __cplusplus
+}
+#endif
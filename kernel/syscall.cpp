@@ -5,24 +5,34 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <fcntl.h>
 #include <memory>
 #include <type_traits>
 
+#include "aio.hpp"
 #include "app_event.hpp"
 #include "asmfunc.hpp"
+#include "draw_command.hpp"
+#include "event_ring.hpp"
 #include "fat.hpp"
 #include "font.hpp"
+#include "futex.hpp"
 #include "graphics.hpp"
-#include "keyboard.hpp"
+#include "io_vec.hpp"
 #include "layer.hpp"
 #include "logger.hpp"
 #include "message.hpp"
 #include "msr.hpp"
+#include "percpu.hpp"
+#include "pipe.hpp"
+#include "poll.hpp"
 #include "sys/errno.h"
+#include "syscall_stats.hpp"
 #include "task.hpp"
 #include "terminal.hpp"
+#include "thread.hpp"
 #include "timer.hpp"
 #include "window.hpp"
 
@@ -42,9 +52,9 @@ Result DoWinFunc(Func f, uint64_t layer_id_flags, Args... args) {
   const uint32_t layer_flags = layer_id_flags >> 32;
   const unsigned int layer_id = layer_id_flags & 0xffff'ffff;
 
-  __asm__("cli");
+  // 描画中にウィンドウが閉じられないよう，再描画までロックを持ち続ける
+  MutexGuard guard{layer_manager->GetMutex()};
   auto layer = layer_manager->FindLayer(layer_id);
-  __asm__("sti");
   if (layer == nullptr) {
     return {0, EBADF};
   }
@@ -55,13 +65,177 @@ Result DoWinFunc(Func f, uint64_t layer_id_flags, Args... args) {
   }
 
   if ((layer_flags & 1) == 0) {
-    __asm__("cli");
     layer_manager->Draw(layer_id);
-    __asm__("sti");
   }
 
   return res;
 }
+
+void DrawLine(PixelWriter &writer, int x0, int y0, int x1, int y1,
+              const PixelColor &color) {
+  auto sign = [](int x) { return (x > 0) ? 1 : (x < 0) ? -1 : 0; };
+  const int dx = x1 - x0 + sign(x1 - x0);
+  const int dy = y1 - y0 + sign(y1 - y0);
+
+  if (dx == 0 && dy == 0) {
+    writer.Write({x0, y0}, color);
+    return;
+  }
+
+  const auto floord = static_cast<double (*)(double)>(floor);
+  const auto ceild = static_cast<double (*)(double)>(ceil);
+
+  if (abs(dx) >= abs(dy)) {
+    if (dx < 0) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+    const auto roundish = y1 >= y0 ? floord : ceild;
+    const double m = static_cast<double>(dy) / dx;
+    for (int x = x0; x <= x1; ++x) {
+      const int y = roundish(m * (x - x0) + y0);
+      writer.Write({x, y}, color);
+    }
+  } else {
+    if (dy < 0) {
+      std::swap(x0, x1);
+      std::swap(y0, y1);
+    }
+    const auto roundish = x1 >= x0 ? floord : ceild;
+    const double m = static_cast<double>(dx) / dy;
+    for (int y = y0; y <= y1; ++y) {
+      const int x = roundish(m * (y - y0) + x0);
+      writer.Write({x, y}, color);
+    }
+  }
+}
+
+// ウィンドウの外に出る画素を捨てる
+class ClippedWriter : public PixelWriter {
+public:
+  ClippedWriter(Window &win) : win{win} {}
+  virtual void Write(Vector2D<int> pos, const PixelColor &c) override {
+    if (0 <= pos.x && pos.x < win.Width() && 0 <= pos.y &&
+        pos.y < win.Height()) {
+      win.Write(pos, c);
+    }
+  }
+  virtual int Width() const override { return win.Width(); }
+  virtual int Height() const override { return win.Height(); }
+
+private:
+  Window &win;
+};
+
+bool IsUserRange(uint64_t addr, uint64_t len) {
+  return addr >= 0x8000'0000'0000'0000 && addr + len >= addr;
+}
+
+// 描画命令が触れうる範囲（ウィンドウでクリップする前）
+Rectangle<int> CommandArea(const DrawCommand &cmd) {
+  switch (cmd.type) {
+  case DrawCommand::kFillRectangle:
+    return {{cmd.arg.fill.x, cmd.arg.fill.y}, {cmd.arg.fill.w, cmd.arg.fill.h}};
+  case DrawCommand::kDrawLine: {
+    const auto &l = cmd.arg.line;
+    const Vector2D<int> p0{l.x0, l.y0}, p1{l.x1, l.y1};
+    const auto pos = ElementMin(p0, p1);
+    return {pos, ElementMax(p0, p1) - pos + Vector2D<int>{1, 1}};
+  }
+  case DrawCommand::kWriteString:
+    // 文字列の長さは描画するまでわからないので右端まで含める
+    return {{cmd.arg.text.x, cmd.arg.text.y}, {1 << 20, 16}};
+  case DrawCommand::kBlit:
+    return {{cmd.arg.blit.x, cmd.arg.blit.y}, {cmd.arg.blit.w, cmd.arg.blit.h}};
+  }
+  return {{0, 0}, {0, 0}};
+}
+
+// x から描き始めた文字列のうち，ウィンドウの右端までに収まる文字数
+int64_t TextColumns(const Window &win, int x) {
+  return x < win.Width() ? (static_cast<int64_t>(win.Width()) - x + 7) / 8 : 0;
+}
+
+int ValidateCommand(const Window &win, const DrawCommand &cmd) {
+  switch (cmd.type) {
+  case DrawCommand::kFillRectangle:
+  case DrawCommand::kDrawLine:
+    return 0;
+  case DrawCommand::kWriteString: {
+    // 描画で読むのは右端までの文字なので，その長さだけを確かめる
+    const auto s = reinterpret_cast<uint64_t>(cmd.arg.text.s);
+    const int64_t len = TextColumns(win, cmd.arg.text.x);
+    return len == 0 || IsUserRange(s, len) ? 0 : EFAULT;
+  }
+  case DrawCommand::kBlit: {
+    const auto &b = cmd.arg.blit;
+    if (b.w < 0 || b.h < 0) {
+      return EINVAL;
+    }
+    // 右下の座標とバッファの長さが桁あふれしないことを確かめておけば，
+    // 描画範囲の計算と画素の添字は範囲内に収まる
+    int x_end, y_end;
+    uint64_t len;
+    if (__builtin_add_overflow(b.x, b.w, &x_end) ||
+        __builtin_add_overflow(b.y, b.h, &y_end) ||
+        __builtin_mul_overflow(static_cast<uint64_t>(b.w) * b.h,
+                               sizeof(uint32_t), &len)) {
+      return EINVAL;
+    }
+    return IsUserRange(reinterpret_cast<uint64_t>(b.pixels), len) ? 0 : EFAULT;
+  }
+  }
+  return EINVAL;
+}
+
+// area はウィンドウでクリップ済み．実際に描いた範囲を返す
+Rectangle<int> ExecuteCommand(Window &win, const DrawCommand &cmd,
+                              const Rectangle<int> &area) {
+  const auto color = ToColor(cmd.color);
+  switch (cmd.type) {
+  case DrawCommand::kFillRectangle:
+    FillRectangle(win, area.pos, area.size, color);
+    break;
+  case DrawCommand::kDrawLine: {
+    ClippedWriter writer{win};
+    const auto &l = cmd.arg.line;
+    DrawLine(writer, l.x0, l.y0, l.x1, l.y1, color);
+    break;
+  }
+  case DrawCommand::kWriteString: {
+    // ウィンドウの右端を越えた文字は読まない
+    ClippedWriter writer{win};
+    const auto &t = cmd.arg.text;
+    const int64_t len = TextColumns(win, t.x);
+    int i = 0;
+    for (; i < len && t.s[i]; ++i) {
+      WriteAscii(writer, {t.x + 8 * i, t.y}, t.s[i], color);
+    }
+    return area & Rectangle<int>{{t.x, t.y}, {8 * i, 16}};
+  }
+  case DrawCommand::kBlit: {
+    const auto &b = cmd.arg.blit;
+    const auto end = area.pos + area.size;
+    for (int y = area.pos.y; y < end.y; ++y) {
+      const uint32_t *row = &b.pixels[static_cast<int64_t>(y - b.y) * b.w];
+      for (int x = area.pos.x; x < end.x; ++x) {
+        win.Write({x, y}, ToColor(row[x - b.x]));
+      }
+    }
+    break;
+  }
+  }
+  return area;
+}
+// 別のスレッドが CloseFile しても使っている間は解放されないよう，
+// 参照を増やして返す
+std::shared_ptr<::FileDescriptor> FindFD(int fd) {
+  auto &files = task_manager->CurrentTask().Files();
+  if (fd < 0 || files.size() <= fd || !files[fd]) {
+    return nullptr;
+  }
+  return files[fd];
+}
 } // namespace
 
 SYSCALL(LogString) {
@@ -81,24 +255,19 @@ SYSCALL(PutString) {
   const auto fd = arg1;
   const char *s = reinterpret_cast<const char *>(arg2);
   const auto len = arg3;
-  if (len > 1024) {
-    return {0, E2BIG};
-  }
-
-  __asm__("cli");
-  auto &task = task_manager->CurrentTask();
-  __asm__("sti");
-
-  if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+  auto file = FindFD(fd);
+  if (file == nullptr) {
     return {0, EBADF};
   }
-  return {task.Files()[fd]->Write(s, len), 0};
+  // 端末などへの一度の出力は制限するが，ファイルにはまとめて書ける
+  if (len > 1024 && !file->Seekable()) {
+    return {0, E2BIG};
+  }
+  return {file->Write(s, len), 0};
 }
 
 SYSCALL(Exit) {
-  __asm__("cli");
   auto &task = task_manager->CurrentTask();
-  __asm__("sti");
   return {task.OSStackPointer(), static_cast<int>(arg1)};
 }
 
@@ -108,7 +277,7 @@ SYSCALL(OpenWindow) {
   const auto win =
       std::make_shared<ToplevelWindow>(w, h, screen_config.pixel_format, title);
 
-  __asm__("cli");
+  MutexGuard guard{layer_manager->GetMutex()};
   const auto layer_id = layer_manager->NewLayer()
                             .SetWindow(win)
                             .SetDraggable(true)
@@ -118,7 +287,6 @@ SYSCALL(OpenWindow) {
 
   const auto task_id = task_manager->CurrentTask().ID();
   layer_task_map->insert(std::make_pair(layer_id, task_id));
-  __asm__("sti");
 
   return {layer_id, 0};
 }
@@ -152,42 +320,7 @@ SYSCALL(WinRedraw) {
 SYSCALL(WinDrawLine) {
   return DoWinFunc(
       [](Window &win, int x0, int y0, int x1, int y1, uint32_t color) {
-        auto sign = [](int x) { return (x > 0) ? 1 : (x < 0) ? -1 : 0; };
-        const int dx = x1 - x0 + sign(x1 - x0);
-        const int dy = y1 - y0 + sign(y1 - y0);
-
-        if (dx == 0 && dy == 0) {
-          win.Write({x0, y0}, ToColor(color));
-          return Result{0, 0};
-        }
-
-        const auto floord = static_cast<double (*)(double)>(floor);
-        const auto ceild = static_cast<double (*)(double)>(ceil);
-
-        if (abs(dx) >= abs(dy)) {
-          if (dx < 0) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
-          }
-          const auto roundish = y1 >= y0 ? floord : ceild;
-          const double m = static_cast<double>(dy) / dx;
-          for (int x = x0; x <= x1; ++x) {
-            const int y = roundish(m * (x - x0) + y0);
-            win.Write({x, y}, ToColor(color));
-          }
-        } else {
-          if (dy < 0) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
-          }
-          const auto roundish = x1 >= x0 ? floord : ceild;
-          const double m = static_cast<double>(dx) / dy;
-          for (int y = y0; y <= y1; ++y) {
-            const int x = roundish(m * (y - y0) + x0);
-            win.Write({x, y}, ToColor(color));
-          }
-        }
-
+        DrawLine(win, x0, y0, x1, y1, ToColor(color));
         return Result{0, 0};
       },
       arg1, arg2, arg3, arg4, arg5, arg6);
@@ -195,6 +328,7 @@ SYSCALL(WinDrawLine) {
 
 SYSCALL(CloseWindow) {
   const unsigned int layer_id = arg1 & 0xffff'ffff;
+  MutexGuard guard{layer_manager->GetMutex()};
   const auto layer = layer_manager->FindLayer(layer_id);
 
   if (layer == nullptr) {
@@ -204,12 +338,10 @@ SYSCALL(CloseWindow) {
   const auto layer_pos = layer->GetPosition();
   const auto win_size = layer->GetWindow()->Size();
 
-  __asm__("cli");
   active_layer->Activate(0);
   layer_manager->RemoveLayer(layer_id);
   layer_manager->Draw({layer_pos, win_size});
   layer_task_map->erase(layer_id);
-  __asm__("sti");
 
   return {0, 0};
 }
@@ -221,64 +353,30 @@ SYSCALL(ReadEvent) {
   const auto app_events = reinterpret_cast<AppEvent *>(arg1);
   const size_t len = arg2;
 
-  __asm__("cli");
   auto &task = task_manager->CurrentTask();
-  __asm__("sti");
   size_t i = 0;
 
   while (i < len) {
     __asm__("cli");
     auto msg = task.ReceiveMessage();
     if (!msg && i == 0) {
+      if (task.ExitRequested()) {
+        __asm__("sti");
+        return {0, EINTR};
+      }
       task.Sleep();
+      __asm__("sti");
       continue;
     }
+    __asm__("sti");
 
     if (!msg) {
       break;
     }
 
-    switch (msg->type) {
-    case Message::kKeyPush:
-      if (msg->arg.keyboard.keycode == 20 &&
-          msg->arg.keyboard.modifier & (kLControlBitMask | kRControlBitMask)) {
-        app_events[i].type = AppEvent::kQuit;
-        ++i;
-      } else {
-        app_events[i].type = AppEvent::kKeyPush;
-        app_events[i].arg.keypush.modifier = msg->arg.keyboard.modifier;
-        app_events[i].arg.keypush.keycode = msg->arg.keyboard.keycode;
-        app_events[i].arg.keypush.ascii = msg->arg.keyboard.ascii;
-        app_events[i].arg.keypush.press = msg->arg.keyboard.press;
-        ++i;
-      }
-      break;
-    case Message::kMouseMove:
-      app_events[i].type = AppEvent::kMouseMove;
-      app_events[i].arg.mouse_move.x = msg->arg.mouse_move.x;
-      app_events[i].arg.mouse_move.y = msg->arg.mouse_move.y;
-      app_events[i].arg.mouse_move.dx = msg->arg.mouse_move.dx;
-      app_events[i].arg.mouse_move.dy = msg->arg.mouse_move.dy;
-      app_events[i].arg.mouse_move.buttons = msg->arg.mouse_move.buttons;
+    if (ToAppEvent(*msg, app_events[i])) {
       ++i;
-      break;
-    case Message::kMouseButton:
-      app_events[i].type = AppEvent::kMouseButton;
-      app_events[i].arg.mouse_button.x = msg->arg.mouse_button.x;
-      app_events[i].arg.mouse_button.y = msg->arg.mouse_button.y;
-      app_events[i].arg.mouse_button.press = msg->arg.mouse_button.press;
-      app_events[i].arg.mouse_button.button = msg->arg.mouse_button.button;
-      ++i;
-      break;
-    case Message::kTimerTimeout:
-      if (msg->arg.timer.value < 0) {
-        app_events[i].type = AppEvent::kTimerTimeout;
-        app_events[i].arg.timer.timeout = msg->arg.timer.timeout;
-        app_events[i].arg.timer.value = -msg->arg.timer.value;
-        ++i;
-      }
-      break;
-    default:
+    } else if (msg->type != Message::kTimerTimeout) {
       Log(kInfo, "uncaught event type: %u\n", msg->type);
     }
   }
@@ -293,18 +391,14 @@ SYSCALL(CreateTimer) {
     return {0, EINVAL};
   }
 
-  __asm__("cli");
   const uint64_t task_id = task_manager->CurrentTask().ID();
-  __asm__("sti");
 
   unsigned long timeout = arg3 * kTimerFreq / 1000;
   if (mode & 1) {
     timeout += timer_manager->CurrentTick();
   }
 
-  __asm__("cli");
   timer_manager->AddTimer(Timer{timeout, -timer_value, task_id});
-  __asm__("sti");
   return {timeout * 1000 / kTimerFreq, 0};
 }
 
@@ -339,13 +433,16 @@ std::pair<fat::DirectoryEntry *, int> CreateFile(const char *path) {
 SYSCALL(OpenFile) {
   const char *path = reinterpret_cast<const char *>(arg1);
   const int flags = arg2;
-  __asm__("cli");
   auto &task = task_manager->CurrentTask();
-  __asm__("sti");
 
   if (strcmp(path, "@stdin") == 0) {
     return {0, 0};
   }
+  if (strcmp(path, "@sysstat") == 0) {
+    size_t fd = AllocateFD(task);
+    task.Files()[fd] = OpenSyscallStatsFile();
+    return {fd, 0};
+  }
 
   auto [file, post_slash] = fat::FindFile(path);
   if (file == nullptr) {
@@ -359,6 +456,9 @@ SYSCALL(OpenFile) {
     file = new_file;
   } else if (file->attr != fat::Attribute::kDirectory && post_slash) {
     return {0, ENOENT};
+  } else if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY) {
+    // クラスタはそのまま残し，次の書き込みで使い直す
+    file->file_size = 0;
   }
 
   size_t fd = AllocateFD(task);
@@ -370,21 +470,16 @@ SYSCALL(ReadFile) {
   const int fd = arg1;
   void *buf = reinterpret_cast<void *>(arg2);
   size_t count = arg3;
-  __asm__("cli");
-  auto &task = task_manager->CurrentTask();
-  __asm__("sti");
-
-  if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+  auto file = FindFD(fd);
+  if (file == nullptr) {
     return {0, EBADF};
   }
-  return {task.Files()[fd]->Read(buf, count), 0};
+  return {file->Read(buf, count), 0};
 }
 
 SYSCALL(DemandPages) {
   const size_t num_pages = arg1;
-  __asm__("cli");
   auto &task = task_manager->CurrentTask();
-  __asm__("sti");
 
   const uint64_t dp_end = task.DPagingEnd();
   task.SetDPagingEnd(dp_end + 4096 * num_pages);
@@ -394,9 +489,7 @@ SYSCALL(DemandPages) {
 SYSCALL(MapFile) {
   const int fd = arg1;
   size_t *file_size = reinterpret_cast<size_t *>(arg2);
-  __asm__("cli");
   auto &task = task_manager->CurrentTask();
-  __asm__("sti");
   if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
     return {0, EBADF};
   }
@@ -405,16 +498,403 @@ SYSCALL(MapFile) {
   const uint64_t vaddr_end = task.FileMapEnd();
   const uint64_t vaddr_begin = (vaddr_end - *file_size) & 0xffff'ffff'ffff'f000;
   task.SetFileMapEnd(vaddr_begin);
-  task.FileMaps().push_back(FileMapping{fd, vaddr_begin, vaddr_end});
+  task.FileMaps().push_back(
+      FileMapping{task.Files()[fd], vaddr_begin, vaddr_end});
   return {vaddr_begin, 0};
 }
 
+SYSCALL(FutexWait) {
+  const uint64_t uaddr = arg1;
+  const uint32_t expected = arg2;
+  const unsigned long timeout_ms = arg3;
+  if (uaddr < 0x8000'0000'0000'0000 || uaddr % sizeof(uint32_t) != 0) {
+    return {0, EINVAL};
+  }
+
+  switch (::FutexWait(uaddr, expected, timeout_ms).Cause()) {
+  case Error::kSuccess:
+    return {0, 0};
+  case Error::kValueMismatch:
+    return {0, EAGAIN};
+  case Error::kTimeout:
+    return {0, ETIMEDOUT};
+  default:
+    return {0, EFAULT};
+  }
+}
+
+SYSCALL(FutexWake) {
+  const uint64_t uaddr = arg1;
+  const int num_waiters = arg2;
+  if (uaddr < 0x8000'0000'0000'0000 || uaddr % sizeof(uint32_t) != 0) {
+    return {0, EINVAL};
+  }
+
+  auto [num_woken, err] = ::FutexWake(uaddr, num_waiters);
+  if (err) {
+    return {0, EFAULT};
+  }
+  return {static_cast<uint64_t>(num_woken), 0};
+}
+
+SYSCALL(CreateThread) {
+  const uint64_t entry = arg1;
+  const uint64_t stack_top = arg2;
+  const uint64_t arg = arg3;
+  if (entry < 0x8000'0000'0000'0000 || stack_top < 0x8000'0000'0000'0000) {
+    return {0, EFAULT};
+  }
+
+  auto [thread_id, err] = ::CreateThread(entry, stack_top, arg);
+  if (err) {
+    return {0, EAGAIN};
+  }
+  return {thread_id, 0};
+}
+
+SYSCALL(JoinThread) {
+  auto [exit_code, err] = ::JoinThread(arg1);
+  switch (err.Cause()) {
+  case Error::kSuccess:
+    return {static_cast<uint64_t>(exit_code), 0};
+  case Error::kInterrupted:
+    return {0, EINTR};
+  default:
+    return {0, ESRCH};
+  }
+}
+
+SYSCALL(Spawn) {
+  const auto path = reinterpret_cast<const char *>(arg1);
+  auto argv = reinterpret_cast<const char *const *>(arg2);
+  const auto fds = reinterpret_cast<const int *>(arg3);
+  if (arg1 < 0x8000'0000'0000'0000 ||
+      (argv && arg2 < 0x8000'0000'0000'0000) ||
+      (fds && arg3 < 0x8000'0000'0000'0000)) {
+    return {0, EFAULT};
+  }
+  // argv を省略したらパスだけを渡す
+  const char *default_argv[] = {path, nullptr};
+  if (argv == nullptr) {
+    argv = default_argv;
+  }
+  for (int i = 0; argv[i]; ++i) {
+    if (reinterpret_cast<uint64_t>(argv[i]) < 0x8000'0000'0000'0000) {
+      return {0, EFAULT};
+    }
+  }
+
+  auto [file, post_slash] = fat::FindFile(path);
+  if (file == nullptr ||
+      (file->attr != fat::Attribute::kDirectory && post_slash)) {
+    return {0, ENOENT};
+  } else if (file->attr == fat::Attribute::kDirectory) {
+    return {0, EISDIR};
+  }
+
+  // fds を省略したら標準入出力を引き継ぐ
+  auto &task = task_manager->CurrentTask();
+  std::array<std::shared_ptr<::FileDescriptor>, 3> stdio;
+  for (int i = 0; i < 3; ++i) {
+    const int fd = fds ? fds[i] : i;
+    if (fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+      return {0, EBADF};
+    }
+    stdio[i] = task.Files()[fd];
+  }
+
+  auto [app_id, err] = SpawnApp(*file, argv, std::move(stdio));
+  switch (err.Cause()) {
+  case Error::kSuccess:
+    return {app_id, 0};
+  case Error::kFull:
+    return {0, E2BIG};
+  default:
+    return {0, EAGAIN};
+  }
+}
+
+SYSCALL(WaitApp) {
+  auto [result, err] = ::WaitApp(arg1);
+  switch (err.Cause()) {
+  case Error::kSuccess:
+    return {static_cast<uint64_t>(result), 0};
+  case Error::kInterrupted:
+    return {0, EINTR};
+  default:
+    return {0, ECHILD};
+  }
+}
+
+// 描画命令の列をまとめて実行し，描き変えた範囲だけを最後に再描画する．
+// 不正な命令があればそこで止め，実行できた命令の数とエラーを返す
+SYSCALL(WinDrawCommands) {
+  const uint32_t layer_flags = arg1 >> 32;
+  const unsigned int layer_id = arg1 & 0xffff'ffff;
+  const auto cmds = reinterpret_cast<const DrawCommand *>(arg2);
+  const size_t num_cmds = arg3;
+
+  if (num_cmds > (~0ul >> 1) / sizeof(DrawCommand) ||
+      !IsUserRange(arg2, num_cmds * sizeof(DrawCommand))) {
+    return {0, EFAULT};
+  }
+
+  MutexGuard guard{layer_manager->GetMutex()};
+  auto layer = layer_manager->FindLayer(layer_id);
+  if (layer == nullptr) {
+    return {0, EBADF};
+  }
+  Window &win = *layer->GetWindow();
+  const Rectangle<int> win_area{{0, 0}, win.Size()};
+
+  Vector2D<int> damage_start{win_area.size}, damage_end{0, 0};
+  size_t i = 0;
+  int err = 0;
+  for (; i < num_cmds; ++i) {
+    // 検査の後で他のスレッドに書き換えられないように，コピーしてから使う
+    const DrawCommand cmd = cmds[i];
+    if ((err = ValidateCommand(win, cmd))) {
+      break;
+    }
+    auto area = CommandArea(cmd) & win_area;
+    if (area.size.x <= 0 || area.size.y <= 0) {
+      continue;
+    }
+    area = ExecuteCommand(win, cmd, area);
+    if (area.size.x > 0 && area.size.y > 0) {
+      damage_start = ElementMin(damage_start, area.pos);
+      damage_end = ElementMax(damage_end, area.pos + area.size);
+    }
+  }
+
+  if ((layer_flags & 1) == 0 && damage_start.x < damage_end.x &&
+      damage_start.y < damage_end.y) {
+    layer_manager->Draw(layer_id, {damage_start, damage_end - damage_start});
+  }
+  return {i, err};
+}
+
+SYSCALL(OpenEventRing) {
+  auto [vaddr, err] = ::OpenEventRing(task_manager->CurrentTask());
+  switch (err.Cause()) {
+  case Error::kSuccess:
+    return {vaddr, 0};
+  case Error::kAlreadyAllocated:
+    return {0, EBUSY};
+  default:
+    return {0, ENOMEM};
+  }
+}
+
+namespace {
+Result DoAsyncIO(bool write, uint64_t fd, uint64_t buf, uint64_t count) {
+  if (buf < 0x8000'0000'0000'0000 || buf + count < buf) {
+    return {0, EFAULT};
+  }
+  auto [id, err] =
+      SubmitAsyncIO(task_manager->CurrentTask(), write, fd, buf, count);
+  switch (err.Cause()) {
+  case Error::kSuccess:
+    return {id, 0};
+  case Error::kInvalidFile:
+    return {0, EBADF};
+  case Error::kNotImplemented:
+    return {0, ENOTSUP};
+  default:
+    return {0, EAGAIN};
+  }
+}
+} // namespace
+
+// 読み書きの完了は AppEvent::kIOComplete で知らせる
+SYSCALL(AsyncRead) { return DoAsyncIO(false, arg1, arg2, arg3); }
+
+SYSCALL(AsyncWrite) { return DoAsyncIO(true, arg1, arg2, arg3); }
+
+SYSCALL(Poll) {
+  const size_t nfds = arg2;
+  const int64_t timeout_ns = arg3;
+  if (nfds > kMaxPollFDs) {
+    return {0, EINVAL};
+  } else if (!IsUserRange(arg1, nfds * sizeof(PollFD))) {
+    return {0, EFAULT};
+  }
+
+  auto [num_ready, err] = ::Poll(task_manager->CurrentTask(),
+                                 reinterpret_cast<PollFD *>(arg1), nfds,
+                                 timeout_ns);
+  if (err) {
+    return {0, EINTR};
+  }
+  return {static_cast<uint64_t>(num_ready), 0};
+}
+
+namespace {
+// 要素を順に読み書きし，途中で足りなければそこでやめる
+Result DoVectorIO(bool write, int fd, uint64_t iov_addr, int iovcnt) {
+  auto file = FindFD(fd);
+  if (file == nullptr) {
+    return {0, EBADF};
+  } else if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    return {0, EINVAL};
+  } else if (!IsUserRange(iov_addr, iovcnt * sizeof(IOVec))) {
+    return {0, EFAULT};
+  }
+
+  std::array<IOVec, IOV_MAX> iov;
+  memcpy(iov.data(), reinterpret_cast<const IOVec *>(iov_addr),
+         iovcnt * sizeof(IOVec));
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    if (!IsUserRange(reinterpret_cast<uint64_t>(iov[i].base), iov[i].len)) {
+      return {0, EFAULT};
+    }
+    const size_t n = write ? file->Write(iov[i].base, iov[i].len)
+                           : file->Read(iov[i].base, iov[i].len);
+    total += n;
+    if (n < iov[i].len) {
+      break;
+    }
+  }
+  return {total, 0};
+}
+} // namespace
+
+SYSCALL(CloseFile) {
+  const int fd = arg1;
+  if (FindFD(fd) == nullptr) {
+    return {0, EBADF};
+  }
+  task_manager->CurrentTask().Files()[fd].reset();
+  return {0, 0};
+}
+
+SYSCALL(SeekFile) {
+  const int64_t offset = arg2;
+  const int whence = arg3;
+  auto file = FindFD(arg1);
+  if (file == nullptr) {
+    return {0, EBADF};
+  } else if (!file->Seekable()) {
+    return {0, ESPIPE};
+  }
+
+  int64_t pos = offset;
+  if (whence == SEEK_CUR) {
+    pos += file->Offset();
+  } else if (whence == SEEK_END) {
+    pos += file->Size();
+  } else if (whence != SEEK_SET) {
+    return {0, EINVAL};
+  }
+  // 穴のあるファイルは作れないので，末尾より先には移動できない
+  if (pos < 0 || pos > file->Size()) {
+    return {0, EINVAL};
+  }
+  file->SetOffset(pos);
+  return {static_cast<uint64_t>(pos), 0};
+}
+
+SYSCALL(StatFile) {
+  auto file = FindFD(arg1);
+  if (file == nullptr) {
+    return {0, EBADF};
+  } else if (!IsUserRange(arg2, sizeof(FileStat))) {
+    return {0, EFAULT};
+  }
+  file->Stat(*reinterpret_cast<FileStat *>(arg2));
+  return {0, 0};
+}
+
+// Offset を変えずに，指定した位置から読み書きする
+SYSCALL(ReadFileAt) {
+  void *buf = reinterpret_cast<void *>(arg2);
+  const size_t count = arg3;
+  const size_t offset = arg4;
+  auto file = FindFD(arg1);
+  if (file == nullptr) {
+    return {0, EBADF};
+  } else if (!file->Seekable()) {
+    return {0, ESPIPE};
+  } else if (!IsUserRange(arg2, count)) {
+    return {0, EFAULT};
+  } else if (offset >= file->Size()) {
+    return {0, 0};
+  }
+  return {file->Load(buf, count, offset), 0};
+}
+
+SYSCALL(WriteFileAt) {
+  const void *buf = reinterpret_cast<const void *>(arg2);
+  const size_t count = arg3;
+  const size_t offset = arg4;
+  auto file = FindFD(arg1);
+  if (file == nullptr) {
+    return {0, EBADF};
+  } else if (!file->Seekable()) {
+    return {0, ESPIPE};
+  } else if (!IsUserRange(arg2, count)) {
+    return {0, EFAULT};
+  } else if (offset > file->Size()) {
+    return {0, EINVAL};
+  }
+  return {file->Store(buf, count, offset), 0};
+}
+
+SYSCALL(ReadFileV) { return DoVectorIO(false, arg1, arg2, arg3); }
+
+SYSCALL(WriteFileV) { return DoVectorIO(true, arg1, arg2, arg3); }
+
+// 両方の fd の位置から読み書きし，それぞれの位置を進める
+SYSCALL(CopyFileRange) {
+  const size_t count = arg3;
+  auto in = FindFD(arg1);
+  auto out = FindFD(arg2);
+  if (in == nullptr || out == nullptr) {
+    return {0, EBADF};
+  }
+  auto fat_in = in->FATFile();
+  auto fat_out = out->FATFile();
+  if (fat_in && out->CanSplice()) {
+    // パイプにはクラスタから直接写す
+    return {fat_in->SpliceTo(*out, count), 0};
+  } else if (fat_in == nullptr || fat_out == nullptr) {
+    return {0, EINVAL};
+  }
+
+  auto [copied, err] = fat_out->CopyFrom(*fat_in, count);
+  if (err) {
+    return {0, EINVAL};
+  }
+  return {copied, 0};
+}
+
+SYSCALL(CreatePipe) {
+  if (!IsUserRange(arg1, 2 * sizeof(int))) {
+    return {0, EFAULT};
+  }
+  auto fds = reinterpret_cast<int *>(arg1);
+  auto &task = task_manager->CurrentTask();
+  auto [read_end, write_end] = MakePipe();
+
+  fds[0] = AllocateFD(task);
+  task.Files()[fds[0]] = std::move(read_end);
+  fds[1] = AllocateFD(task);
+  task.Files()[fds[1]] = std::move(write_end);
+  return {0, 0};
+}
+
+// 範囲外の番号で呼ばれたとき
+SYSCALL(Invalid) { return {0, ENOSYS}; }
+
 #undef SYSCALL
 } // namespace syscall
 
 using SyscallFuncType = syscall::Result(uint64_t, uint64_t, uint64_t, uint64_t,
                                         uint64_t, uint64_t);
-extern "C" std::array<SyscallFuncType *, 0x10> syscall_table{
+extern "C" SyscallFuncType *const syscall_invalid = syscall::Invalid;
+
+extern "C" std::array<SyscallFuncType *, kNumSyscalls> syscall_table{
     /* 0x00 */ syscall::LogString,
     /* 0x01 */ syscall::PutString,
     /* 0x02 */ syscall::Exit,
@@ -431,12 +911,68 @@ extern "C" std::array<SyscallFuncType *, 0x10> syscall_table{
     /* 0x0d */ syscall::ReadFile,
     /* 0x0e */ syscall::DemandPages,
     /* 0x0f */ syscall::MapFile,
+    /* 0x10 */ syscall::FutexWait,
+    /* 0x11 */ syscall::FutexWake,
+    /* 0x12 */ syscall::CreateThread,
+    /* 0x13 */ syscall::JoinThread,
+    /* 0x14 */ syscall::Spawn,
+    /* 0x15 */ syscall::WaitApp,
+    /* 0x16 */ syscall::WinDrawCommands,
+    /* 0x17 */ syscall::OpenEventRing,
+    /* 0x18 */ syscall::AsyncRead,
+    /* 0x19 */ syscall::AsyncWrite,
+    /* 0x1a */ syscall::Poll,
+    /* 0x1b */ syscall::CloseFile,
+    /* 0x1c */ syscall::SeekFile,
+    /* 0x1d */ syscall::StatFile,
+    /* 0x1e */ syscall::ReadFileAt,
+    /* 0x1f */ syscall::WriteFileAt,
+    /* 0x20 */ syscall::ReadFileV,
+    /* 0x21 */ syscall::WriteFileV,
+    /* 0x22 */ syscall::CopyFileRange,
+    /* 0x23 */ syscall::CreatePipe,
+};
+extern "C" const size_t num_syscalls = syscall_table.size();
+
+namespace {
+const std::array<const char *, kNumSyscalls> syscall_names{
+    "LogString", "PutString", "Exit", "OpenWindow", "WinWriteString",
+    "WinFillRectangle", "GetCurrentTick", "WinRedraw", "WinDrawLine",
+    "CloseWindow", "ReadEvent", "CreateTimer", "OpenFile", "ReadFile",
+    "DemandPages", "MapFile", "FutexWait", "FutexWake", "CreateThread",
+    "JoinThread", "Spawn", "WaitApp", "WinDrawCommands", "OpenEventRing",
+    "AsyncRead", "AsyncWrite", "Poll", "CloseFile", "SeekFile", "StatFile",
+    "ReadFileAt", "WriteFileAt", "ReadFileV", "WriteFileV", "CopyFileRange",
+    "CreatePipe",
 };
+} // namespace
+
+const char *SyscallName(size_t num) {
+  return num < syscall_names.size() ? syscall_names[num] : "?";
+}
+
+// 統計を取るときは SyscallEntry がテーブルの代わりにこれを呼ぶ
+extern "C" syscall::Result SyscallWithStats(uint64_t arg1, uint64_t arg2,
+                                            uint64_t arg3, uint64_t arg4,
+                                            uint64_t arg5, uint64_t arg6,
+                                            uint64_t num) {
+  const uint64_t start = ReadTSC();
+  const auto res = syscall_table[num](arg1, arg2, arg3, arg4, arg5, arg6);
+  RecordSyscall(num, ReadTSC() - start);
+  return res;
+}
+
+namespace {
+const uint64_t kRFlagsIF = 1u << 9;
+const uint64_t kRFlagsDF = 1u << 10;
+} // namespace
 
 void InitializeSyscall() {
   WriteMSR(kIA32_EFER, 0x0501u);
   WriteMSR(kIA32_LSTAR, reinterpret_cast<uint64_t>(SyscallEntry));
   WriteMSR(kIA32_STAR, static_cast<uint64_t>(8) << 32 |
                            static_cast<uint64_t>(16 | 3) << 48);
-  WriteMSR(kIA32_FMASK, 0);
+  // 入口で swapgs してから OS 用スタックに移るまでは割り込みを禁止する
+  WriteMSR(kIA32_FMASK, kRFlagsIF | kRFlagsDF);
+  WriteMSR(kIA32_KERNEL_GS_BASE, reinterpret_cast<uint64_t>(&ThisCPU()));
 }
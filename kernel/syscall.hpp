@@ -1,3 +1,8 @@
 #pragma once
 
+#include <cstddef>
+
+const size_t kNumSyscalls = 0x24;
+
 void InitializeSyscall();
+const char *SyscallName(size_t num);
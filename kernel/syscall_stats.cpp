@@ -0,0 +1,177 @@
+#include "syscall_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "task.hpp"
+#include "timer.hpp"
+
+extern "C" bool syscall_stats_enabled = false;
+
+namespace {
+SyscallStatsTable total_stats;
+uint64_t stats_generation = 0;
+
+int HistBucket(uint64_t tsc) {
+  const int b = tsc == 0 ? 0 : 63 - __builtin_clzl(tsc);
+  return b < kSyscallHistBuckets ? b : kSyscallHistBuckets - 1;
+}
+
+void Update(SyscallStatsTable &table, uint64_t num, uint64_t tsc) {
+  if (table.generation != stats_generation) {
+    table.entries.fill(SyscallStats{});
+    table.generation = stats_generation;
+  }
+  auto &stats = table.entries[num];
+  ++stats.calls;
+  stats.total_tsc += tsc;
+  if (stats.max_tsc < tsc) {
+    stats.max_tsc = tsc;
+  }
+  ++stats.hist[HistBucket(tsc)];
+}
+
+uint64_t TSCToNs(uint64_t tsc) {
+  return tsc * 1000000 / (tsc_freq / 1000);
+}
+
+// 呼び出しの割合 permille に達するバケットの上限を返す
+uint64_t Percentile(const SyscallStats &stats, uint64_t permille) {
+  const uint64_t target = (stats.calls * permille + 999) / 1000;
+  uint64_t sum = 0;
+  for (int b = 0; b < kSyscallHistBuckets; ++b) {
+    sum += stats.hist[b];
+    if (sum >= target) {
+      return 2ul << b;
+    }
+  }
+  return stats.max_tsc;
+}
+
+void Append(std::vector<char> &text, const char *s) {
+  text.insert(text.end(), s, s + strlen(s));
+}
+
+void AppendTable(std::vector<char> &text, const SyscallStatsTable &table) {
+  Append(text, "NR NAME                  CALLS  AVG(ns)  P99(ns)  MAX(ns)\n");
+  for (size_t num = 0; num < table.entries.size(); ++num) {
+    const auto &stats = table.entries[num];
+    if (stats.calls == 0) {
+      continue;
+    }
+    char s[128];
+    snprintf(s, sizeof(s), "%02lx %-16s %10lu %8lu %8lu %8lu\n", num,
+             SyscallName(num), stats.calls,
+             TSCToNs(stats.total_tsc / stats.calls),
+             TSCToNs(Percentile(stats, 990)), TSCToNs(stats.max_tsc));
+    Append(text, s);
+  }
+}
+
+class TextFileDescriptor : public ::FileDescriptor {
+public:
+  explicit TextFileDescriptor(std::vector<char> text)
+      : text{std::move(text)} {}
+
+  size_t Read(void *buf, size_t len) override {
+    const size_t n = Load(buf, len, rd_off);
+    rd_off += n;
+    return n;
+  }
+  size_t Write(const void *buf, size_t len) override { return 0; }
+  size_t Size() const override { return text.size(); }
+  size_t Load(void *buf, size_t len, size_t offset) override {
+    if (offset >= text.size()) {
+      return 0;
+    }
+    const size_t n = std::min(len, text.size() - offset);
+    memcpy(buf, &text[offset], n);
+    return n;
+  }
+
+private:
+  std::vector<char> text;
+  size_t rd_off{0};
+};
+} // namespace
+
+void RecordSyscall(uint64_t num, uint64_t tsc) {
+  // 表の確保は割り込みを許可したまま行う
+  auto &table = task_manager->CurrentTask().SyscallStats();
+  if (!table) {
+    table = std::make_unique<SyscallStatsTable>();
+  }
+
+  __asm__("cli");
+  Update(*table, num, tsc);
+  Update(total_stats, num, tsc);
+  __asm__("sti");
+}
+
+void ResetSyscallStats() {
+  __asm__("cli");
+  total_stats.entries.fill(SyscallStats{});
+  ++stats_generation;
+  total_stats.generation = stats_generation;
+  __asm__("sti");
+}
+
+std::vector<char> FormatSyscallStats(uint64_t task_id) {
+  struct TaskTable {
+    uint64_t id;
+    SyscallStatsTable table;
+  };
+  std::vector<TaskTable> tables;
+
+  task_manager->ForEachTask([task_id, &tables](const Task &task) {
+    const auto &table = task.SyscallStats();
+    if (table && table->generation == stats_generation &&
+        (task_id == 0 || task.ID() == task_id)) {
+      tables.push_back({task.ID(), *table});
+    }
+  });
+
+  std::vector<char> text;
+  char s[128];
+  if (task_id == 0) {
+    __asm__("cli");
+    const auto total = total_stats;
+    __asm__("sti");
+    snprintf(s, sizeof(s), "instrumentation: %s\n",
+             syscall_stats_enabled ? "on" : "off");
+    Append(text, s);
+    AppendTable(text, total);
+  }
+  for (const auto &t : tables) {
+    snprintf(s, sizeof(s), "\ntask %lu:\n", t.id);
+    Append(text, s);
+    AppendTable(text, t.table);
+  }
+  return text;
+}
+
+std::vector<char> FormatSyscallHistogram(uint64_t num) {
+  __asm__("cli");
+  const auto stats = total_stats.entries[num];
+  __asm__("sti");
+
+  std::vector<char> text;
+  char s[128];
+  snprintf(s, sizeof(s), "%s: %lu calls\n", SyscallName(num), stats.calls);
+  Append(text, s);
+  Append(text, "   >= CYCLES      COUNT\n");
+  for (int b = 0; b < kSyscallHistBuckets; ++b) {
+    if (stats.hist[b] == 0) {
+      continue;
+    }
+    snprintf(s, sizeof(s), "%12lu %10u\n", b == 0 ? 0 : 1ul << b,
+             stats.hist[b]);
+    Append(text, s);
+  }
+  return text;
+}
+
+std::shared_ptr<::FileDescriptor> OpenSyscallStatsFile() {
+  return std::make_shared<TextFileDescriptor>(FormatSyscallStats());
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "file.hpp"
+#include "syscall.hpp"
+
+// 所要時間（TSC カウント）の log2 ごとのヒストグラム
+const int kSyscallHistBuckets = 32;
+
+struct SyscallStats {
+  uint64_t calls{0};
+  uint64_t total_tsc{0}, max_tsc{0};
+  std::array<uint32_t, kSyscallHistBuckets> hist{};
+};
+
+struct SyscallStatsTable {
+  uint64_t generation{0}; // リセットされた回数．古ければ次の記録で消す
+  std::array<SyscallStats, kNumSyscalls> entries{};
+};
+
+// false の間，SyscallEntry は分岐 1 つだけで計測を飛ばす
+extern "C" bool syscall_stats_enabled;
+
+// 現在のタスクと全体の統計に 1 回の呼び出しを加える
+void RecordSyscall(uint64_t num, uint64_t tsc);
+void ResetSyscallStats();
+
+// task_id が 0 なら全体と各タスクの，そうでなければそのタスクの統計を
+// 表にした文字列を返す
+std::vector<char> FormatSyscallStats(uint64_t task_id = 0);
+// num 番のシステムコールの全体のヒストグラムを文字列にする
+std::vector<char> FormatSyscallHistogram(uint64_t num);
+
+// 開いた時点の FormatSyscallStats() を読み出すファイル（@sysstat）
+std::shared_ptr<::FileDescriptor> OpenSyscallStatsFile();
@@ -6,16 +6,20 @@
 
 #include "asmfunc.hpp"
 #include "error.hpp"
+#include "event_ring.hpp"
+#include "futex.hpp"
+#include "idle.hpp"
+#include "interrupt.hpp"
+#include "lock.hpp"
+#include "logger.hpp"
+#include "percpu.hpp"
 #include "segment.hpp"
+#include "syscall_stats.hpp"
 #include "timer.hpp"
+#include "xsave.hpp"
 
 void InitializeTask() {
   task_manager = new TaskManager;
-
-  __asm__("cli");
-  timer_manager->AddTimer(Timer{timer_manager->CurrentTick() + kTaskTimerPeriod,
-                                kTaskTimerValue, 1});
-  __asm__("sti");
 }
 
 namespace {
@@ -24,21 +28,43 @@ template <class T, class U> void Erase(T &c, const U &value) {
   c.erase(it, c.end());
 }
 
-void TaskIdle(uint64_t task_id, int64_t data) {
-  while (true) {
-    __asm__("hlt");
-  }
+// 起床したタスクに与える vruntime の猶予（タイムスライスの半分）
+uint64_t SleeperBonus(int quantum) {
+  return tsc_freq / kTimerFreq * quantum / 2;
+}
+
+LockStats task_lock_stats{"task_manager"};
+
+void InsertByVRuntime(std::deque<Task *> &queue, size_t first, Task *task) {
+  auto it = std::upper_bound(
+      queue.begin() + first, queue.end(), task->VRuntime(),
+      [](uint64_t v, const Task *t) { return v < t->VRuntime(); });
+  queue.insert(it, task);
 }
 } // namespace
 
-Task::Task(uint64_t id) : id(id) {}
+Task::Task(uint64_t id) : id(id), process{std::make_shared<Process>()} {
+  ext_state_buf.resize(ext_state_size + kExtStateAlign - 1);
+  const auto buf_addr = reinterpret_cast<uint64_t>(&ext_state_buf[0]);
+  context.ext_state = (buf_addr + kExtStateAlign - 1) & ~(kExtStateAlign - 1);
+  InitExtendedStateArea(reinterpret_cast<void *>(context.ext_state));
+}
 
-Task &Task::InitContext(TaskFunc *f, int64_t data) {
-  const size_t stack_size = kDefaultStackBytes / sizeof(stack[0]);
-  stack.resize(stack_size);
-  uint64_t stack_end = reinterpret_cast<uint64_t>(&stack[stack_size]);
+Task &Task::InitContext(TaskFunc *f, int64_t data, size_t stack_bytes) {
+  if (!stack.Valid()) {
+    auto [new_stack, err] = kernel_stack_allocator->Allocate(stack_bytes);
+    if (err) {
+      Log(kError, "failed to allocate kernel stack for task %lu: %s\n", id,
+          err.Name());
+      return *this;
+    }
+    stack = new_stack;
+  }
+  uint64_t stack_end = stack.Top();
 
+  const uint64_t ext_state = context.ext_state;
   memset(&context, 0, sizeof(context));
+  context.ext_state = ext_state;
   context.cr3 = GetCR3();
   context.rflags = 0x202;
   context.cs = kKernelCS;
@@ -48,7 +74,7 @@ Task &Task::InitContext(TaskFunc *f, int64_t data) {
   context.rdi = id;
   context.rsi = data;
 
-  *reinterpret_cast<uint32_t *>(&context.fxsave_area[24]) = 0x1f80;
+  InitExtendedStateArea(reinterpret_cast<void *>(context.ext_state));
 
   return *this;
 }
@@ -71,75 +97,198 @@ Task &Task::Wakeup() {
   return *this;
 }
 
-std::vector<std::unique_ptr<::FileDescriptor>> &Task::Files() {
-  return files;
+std::vector<std::shared_ptr<::FileDescriptor>> &Task::Files() {
+  return process->files;
+}
+
+Task &Task::ShareProcess(Task &owner) {
+  process = owner.process;
+  is_thread = true;
+  return *this;
+}
+
+Task::~Task() {
+  kernel_stack_allocator->Free(stack);
 }
 
 void Task::SendMessage(const Message &msg) {
-  msgs.push_back(msg);
-  Wakeup();
+  task_manager->SendMessage(id, msg);
 }
 
 std::optional<Message> Task::ReceiveMessage() {
-  if (msgs.empty()) {
-    return std::nullopt;
-  }
-
-  auto m = msgs.front();
-  msgs.pop_front();
-  return m;
+  return task_manager->ReceiveMessage(*this);
 }
 
-TaskManager::TaskManager() {
-  Task &task = NewTask().SetLevel(current_level).SetRunning(true);
+TaskManager::TaskManager() : lock{task_lock_stats}, switch_tsc{ReadTSC()} {
+  quantum.fill(kTaskTimerPeriod);
+  quantum[kMaxLevel] = 1; // メインタスクは入力への応答を優先する
+  slots.emplace_back(); // ID 0 は使わず，メインタスクを ID 1 にする
+  Task &task = AllocateTask().SetLevel(current_level).SetRunning(true);
   running[current_level].push_back(&task);
+  SetCurrentTask(&task);
 
-  Task &idle = NewTask().InitContext(TaskIdle, 0).SetLevel(0).SetRunning(true);
+  Task &idle =
+      AllocateTask().InitContext(TaskIdle, 0).SetLevel(0).SetRunning(true);
   running[0].push_back(&idle);
 }
 
 Task &TaskManager::NewTask() {
-  ++latest_id;
-  return *tasks.emplace_back(new Task{latest_id});
+  SpinLockGuard guard{lock};
+  return AllocateTask();
+}
+
+Task &TaskManager::AllocateTask() {
+  uint32_t index;
+  if (free_slots.empty()) {
+    index = slots.size();
+    slots.emplace_back();
+  } else {
+    index = free_slots.back();
+    free_slots.pop_back();
+  }
+  auto &slot = slots[index];
+  const uint64_t id = static_cast<uint64_t>(slot.generation) << 32 | index;
+  slot.task.reset(new Task{id});
+  return *slot.task;
+}
+
+Task *TaskManager::FindTask(uint64_t id) const {
+  const uint32_t index = id & 0xffff'ffffu;
+  if (index >= slots.size()) {
+    return nullptr;
+  }
+  const auto &slot = slots[index];
+  if (!slot.task || slot.generation != id >> 32) {
+    return nullptr;
+  }
+  return slot.task.get();
+}
+
+void TaskManager::Finish() {
+  // 割り込み禁止で呼ばれるので，ゾンビになる前にメインタスクが動くことはない
+  SendMessage(1, Message{Message::kTaskExit});
+
+  SpinLockGuard guard{lock};
+  Task *task = RunningTask();
+  task->SetRunning(false);
+  zombies.push_back(task);
+
+  RotateCurrentRunQueue(true);
+  guard.Release();
+  RestoreContext(&RunningTask()->Context());
+}
+
+void TaskManager::Reap() {
+  std::vector<std::unique_ptr<Task>> dead;
+  SpinLockGuard guard{lock};
+  for (Task *task : zombies) {
+    const uint32_t index = task->ID() & 0xffff'ffffu;
+    dead.push_back(std::move(slots[index].task));
+    ++slots[index].generation;
+    free_slots.push_back(index);
+  }
+  zombies.clear();
+  guard.Release();
+  // デストラクタはロックの外で動かす
+}
+
+void TaskManager::Discard(Task &task) {
+  std::unique_ptr<Task> dead;
+  SpinLockGuard guard{lock};
+  const uint32_t index = task.ID() & 0xffff'ffffu;
+  dead = std::move(slots[index].task);
+  ++slots[index].generation;
+  free_slots.push_back(index);
+  guard.Release();
+}
+
+TaskSwitch TaskManager::Preempt(uint64_t cs) {
+  // 終了するアプリのスレッドはユーザモードに戻さずに止める
+  if ((cs & 3) == 3) {
+    auto &task = CurrentTask();
+    if (task.ExitRequested()) {
+      ExitApp(task.OSStackPointer(), 0);
+    }
+  }
+
+  if (ThisCPU().need_resched || timer_manager->CurrentTick() >= slice_end) {
+    return SwitchTask();
+  }
+  return {nullptr, nullptr};
 }
 
-void TaskManager::SwitchTask(const TaskContext &current_ctx) {
-  TaskContext &task_ctx = task_manager->CurrentTask().Context();
-  memcpy(&task_ctx, &current_ctx, sizeof(TaskContext));
+TaskSwitch TaskManager::SwitchTask() {
+  SpinLockGuard guard{lock};
   Task *current_task = RotateCurrentRunQueue(false);
-  if (&CurrentTask() != current_task) {
-    RestoreContext(&CurrentTask().Context());
+  if (RunningTask() == current_task) {
+    return {nullptr, nullptr};
+  }
+  ++current_task->stats.involuntary_switches;
+  return {&current_task->Context(), &RunningTask()->Context()};
+}
+
+void TaskManager::Yield() {
+  SpinLockGuard guard{lock};
+  Task *current_task = RotateCurrentRunQueue(false);
+  if (RunningTask() != current_task) {
+    ++current_task->stats.voluntary_switches;
+    guard.Release();
+    SwitchContext(&RunningTask()->Context(), &current_task->Context());
   }
 }
 
 void TaskManager::Sleep(Task *task) {
+  SpinLockGuard guard{lock};
+  SleepLocked(task, guard);
+}
+
+Error TaskManager::Sleep(uint64_t id) {
+  SpinLockGuard guard{lock};
+  Task *task = FindTask(id);
+  if (task == nullptr) {
+    return MAKE_ERROR(Error::kNoSuchTask);
+  }
+
+  SleepLocked(task, guard);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+// 実行中のタスクを眠らせる場合は，ロックを解放してから切り替える
+void TaskManager::SleepLocked(Task *task, SpinLockGuard &guard) {
   if (!task->Running()) {
     return;
   }
 
   task->SetRunning(false);
 
-  if (task == running[current_level].front()) {
+  if (task == RunningTask()) {
+    ++task->stats.voluntary_switches;
     Task *current_task = RotateCurrentRunQueue(true);
-    SwitchContext(&CurrentTask().Context(), &current_task->Context());
+    guard.Release();
+    SwitchContext(&RunningTask()->Context(), &current_task->Context());
     return;
   }
 
   Erase(running[task->Level()], task);
 }
 
-Error TaskManager::Sleep(uint64_t id) {
-  auto it = std::find_if(tasks.begin(), tasks.end(),
-                         [id](const auto &t) { return t->ID() == id; });
-  if (it == tasks.end()) {
+void TaskManager::Wakeup(Task *task, int level) {
+  SpinLockGuard guard{lock};
+  WakeupLocked(task, level);
+}
+
+Error TaskManager::Wakeup(uint64_t id, int level) {
+  SpinLockGuard guard{lock};
+  Task *task = FindTask(id);
+  if (task == nullptr) {
     return MAKE_ERROR(Error::kNoSuchTask);
   }
 
-  Sleep(it->get());
+  WakeupLocked(task, level);
   return MAKE_ERROR(Error::kSuccess);
 }
 
-void TaskManager::Wakeup(Task *task, int level) {
+void TaskManager::WakeupLocked(Task *task, int level) {
   if (task->Running()) {
     ChangeLevelRunning(task, level);
     return;
@@ -152,36 +301,56 @@ void TaskManager::Wakeup(Task *task, int level) {
   task->SetLevel(level);
   task->SetRunning(true);
 
-  running[level].push_back(task);
+  PlaceWakeup(task, level);
+  InsertRunQueue(task, level);
   if (level > current_level) {
     level_changed = true;
+    RequestResched();
   }
 }
 
-Error TaskManager::Wakeup(uint64_t id, int level) {
-  auto it = std::find_if(tasks.begin(), tasks.end(),
-                         [id](const auto &t) { return t->ID() == id; });
-  if (it == tasks.end()) {
+// RotateCurrentRunQueue が CPU ごとのデータに記録するので，ロックは要らない
+Task &TaskManager::CurrentTask() const {
+  return *ThisCPU().current_task;
+}
+
+Error TaskManager::SendMessage(uint64_t id, const Message &msg) {
+  SpinLockGuard guard{lock};
+  Task *task = FindTask(id);
+  if (task == nullptr) {
     return MAKE_ERROR(Error::kNoSuchTask);
   }
 
-  Wakeup(it->get(), level);
+  AppEvent event;
+  if (auto ring = task->event_ring; ring && ToAppEvent(msg, event)) {
+    const bool doorbell = PushEventRing(*ring, event);
+    guard.Release();
+    if (doorbell) {
+      // キーは物理アドレスなので，その間にリングが解放されていても害はない
+      FutexWakeKey(reinterpret_cast<uint64_t>(&ring->doorbell), 1);
+    }
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  task->msgs.push_back(msg);
+  WakeupLocked(task, -1);
   return MAKE_ERROR(Error::kSuccess);
 }
 
-Task &TaskManager::CurrentTask() const {
-  return *running[current_level].front();
+void TaskManager::SetEventRing(Task &task, AppEventRing *ring) {
+  SpinLockGuard guard{lock};
+  task.event_ring = ring;
 }
 
-Error TaskManager::SendMessage(uint64_t id, const Message &msg) {
-  auto it = std::find_if(tasks.begin(), tasks.end(),
-                         [id](const auto &t) { return t->ID() == id; });
-  if (it == tasks.end()) {
-    return MAKE_ERROR(Error::kNoSuchTask);
+std::optional<Message> TaskManager::ReceiveMessage(Task &task) {
+  SpinLockGuard guard{lock};
+  if (task.msgs.empty()) {
+    return std::nullopt;
   }
 
-  (*it)->SendMessage(msg);
-  return MAKE_ERROR(Error::kSuccess);
+  auto m = task.msgs.front();
+  task.msgs.pop_front();
+  return m;
 }
 
 void TaskManager::ChangeLevelRunning(Task *task, int level) {
@@ -189,12 +358,14 @@ void TaskManager::ChangeLevelRunning(Task *task, int level) {
     return;
   }
 
-  if (task != running[current_level].front()) {
+  if (task != RunningTask()) {
     Erase(running[task->Level()], task);
-    running[level].push_front(task);
     task->SetLevel(level);
+    PlaceWakeup(task, level);
+    InsertRunQueue(task, level);
     if (level > current_level) {
       level_changed = true;
+      RequestResched();
     }
     return;
   }
@@ -202,11 +373,34 @@ void TaskManager::ChangeLevelRunning(Task *task, int level) {
   running[current_level].pop_front();
   running[level].push_front(task);
   task->SetLevel(level);
+  task->vruntime = std::max(task->vruntime, min_vruntime[level]);
   if (level >= current_level) {
     current_level = level;
   } else {
     current_level = level;
     level_changed = true;
+    RequestResched();
+  }
+}
+
+void TaskManager::SetQuantum(int level, int ticks) {
+  SpinLockGuard guard{lock};
+  quantum[level] = std::max(ticks, 1);
+}
+
+// 割り込みから戻る前にタスクを切り替えるよう自身に IPI を送る．
+// 割り込み禁止中なら sti した時点で割り込みが入る．
+// アイドルタスクが MWAIT で待機中なら need_resched への書き込みだけで起きる
+void TaskManager::RequestResched() {
+  auto &cpu = ThisCPU();
+  if (cpu.need_resched) {
+    return;
+  }
+  cpu.need_resched = 1;
+  if (cpu.polling) {
+    ++cpu.idle.ipi_saved;
+  } else {
+    SendSelfIPI(InterruptVector::kReschedule);
   }
 }
 
@@ -214,11 +408,15 @@ Task *TaskManager::RotateCurrentRunQueue(bool current_sleep) {
   auto &level_queue = running[current_level];
   Task *current_task = level_queue.front();
   level_queue.pop_front();
+  UpdateRuntime(current_task);
   if (!current_sleep) {
-    level_queue.push_back(current_task);
+    InsertByVRuntime(level_queue, 0, current_task);
   }
   if (level_queue.empty()) {
     level_changed = true;
+  } else {
+    min_vruntime[current_level] = std::max(min_vruntime[current_level],
+                                           level_queue.front()->vruntime);
   }
 
   if (level_changed) {
@@ -230,43 +428,108 @@ Task *TaskManager::RotateCurrentRunQueue(bool current_sleep) {
       }
     }
   }
+  SetCurrentTask(RunningTask());
+  slice_end = timer_manager->CurrentTick() + quantum[current_level];
 
   return current_task;
 }
 
+void TaskManager::UpdateRuntime(Task *task) {
+  const uint64_t now = ReadTSC();
+  const uint64_t delta = now - switch_tsc;
+  switch_tsc = now;
+  task->runtime += delta;
+  task->vruntime += delta;
+  if (task->user_mode) {
+    task->stats.user_time += delta;
+  }
+}
+
+void TaskManager::SetCurrentTask(Task *task) {
+  auto &cpu = ThisCPU();
+  cpu.need_resched = 0;
+  cpu.current_task = task;
+  cpu.os_stack_ptr = &task->os_stack_ptr;
+}
+
+void TaskManager::SetUserMode(bool user_mode) {
+  SpinLockGuard guard{lock};
+  Task *task = RunningTask();
+  UpdateRuntime(task);
+  task->user_mode = user_mode;
+}
+
+// 現在のタスクとタスク切り替えの時刻は割り込み禁止の間しか変わらず，
+// 他の CPU が触れることもないのでロックを取らずに更新できる
+void TaskManager::SetUserModeIRQOff(bool user_mode) {
+  Task *task = ThisCPU().current_task;
+  UpdateRuntime(task);
+  task->user_mode = user_mode;
+}
+
+void TaskManager::PlaceWakeup(Task *task, int level) {
+  const uint64_t bonus = SleeperBonus(quantum[level]);
+  const uint64_t min_v = min_vruntime[level];
+  task->vruntime = std::max(task->vruntime, min_v > bonus ? min_v - bonus : 0);
+}
+
+void TaskManager::InsertRunQueue(Task *task, int level) {
+  auto &queue = running[level];
+  // 実行中のタスクは常に先頭に置く
+  const size_t first = level == current_level && !queue.empty() ? 1 : 0;
+  InsertByVRuntime(queue, first, task);
+}
+
 uint64_t &Task::OSStackPointer() {
   return os_stack_ptr;
 }
 
-__attribute__((no_caller_saved_registers)) extern "C" uint64_t
-GetCurrentTaskOSStackPointer() {
-  return task_manager->CurrentTask().OSStackPointer();
+__attribute__((no_caller_saved_registers)) extern "C" void EnterSyscall() {
+  task_manager->SetUserModeIRQOff(false);
+  auto &task = task_manager->CurrentTask();
+  if (task.ExitRequested()) {
+    ExitApp(task.OSStackPointer(), 0);
+  }
+}
+
+__attribute__((no_caller_saved_registers)) extern "C" void LeaveSyscall() {
+  task_manager->SetUserModeIRQOff(true);
+}
+
+__attribute__((no_caller_saved_registers)) extern "C" TaskContext *
+GetCurrentTaskContext() {
+  return &task_manager->CurrentTask().Context();
+}
+
+extern "C" TaskSwitch RescheduleOnInterrupt(uint64_t cs) {
+  NotifyEndOfInterrupt();
+  return task_manager->Preempt(cs);
 }
 
 uint64_t Task::DPagingBegin() const {
-  return dpaging_begin;
+  return process->dpaging_begin;
 }
 
 void Task::SetDPagingBegin(uint64_t v) {
-  dpaging_begin = v;
+  process->dpaging_begin = v;
 }
 
 uint64_t Task::DPagingEnd() const {
-  return dpaging_end;
+  return process->dpaging_end;
 }
 
 void Task::SetDPagingEnd(uint64_t v) {
-  dpaging_end = v;
+  process->dpaging_end = v;
 }
 
 uint64_t Task::FileMapEnd() const {
-  return file_map_end;
+  return process->file_map_end;
 }
 
 void Task::SetFileMapEnd(uint64_t v) {
-  file_map_end = v;
+  process->file_map_end = v;
 }
 
 std::vector<FileMapping> &Task::FileMaps() {
-  return file_maps;
+  return process->file_maps;
 }
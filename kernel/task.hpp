@@ -1,44 +1,97 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <deque>
+#include <map>
 #include <memory>
 #include <optional>
 #include <vector>
 
+#include "app_event.hpp"
 #include "error.hpp"
 #include "fat.hpp"
+#include "kernel_stack.hpp"
+#include "lock.hpp"
 #include "message.hpp"
+#include "wait_queue.hpp"
 
 struct TaskContext {
   uint64_t cr3, rip, rflags, reserved1;
   uint64_t cs, ss, fs, gs;
   uint64_t rax, rbx, rcx, rdx, rdi, rsi, rsp, rbp;
   uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
-  std::array<int8_t, 512> fxsave_area;
+  uint64_t ext_state; // XSAVE/FXSAVE 領域へのポインタ
 } __attribute__((packed));
 
 alignas(16) inline TaskContext task_b_ctx, task_a_ctx;
 
+// タイマ割り込みでのタスク切り替え．切り替えない場合は両方 nullptr
+struct TaskSwitch {
+  TaskContext *prev, *next;
+};
+
 void InitializeTask();
 
 using TaskFunc = void(uint64_t, int64_t);
 
+class Task;
 class TaskManager;
+struct SyscallStatsTable;
+
+struct TaskStats {
+  uint64_t user_time; // TSC カウント
+  uint64_t voluntary_switches, involuntary_switches;
+  uint64_t page_faults;
+};
 
+// fd を閉じてもマップは残るので，ファイルは番号でなく参照で持つ
 struct FileMapping {
-  int fd;
+  std::shared_ptr<::FileDescriptor> fd;
   uint64_t vaddr_begin, vaddr_end;
 };
 
+struct AsyncIORequest {
+  uint64_t id, task_id; // task_id は完了を知らせるタスク
+  bool write;
+  std::shared_ptr<::FileDescriptor> fd;
+  uint64_t buf;
+  size_t count;
+};
+
+// 同じアプリのスレッド間で共有する状態
+struct Process {
+  // 子のアプリと共有することがある
+  std::vector<std::shared_ptr<::FileDescriptor>> files{};
+  uint64_t dpaging_begin{0}, dpaging_end{0};
+  uint64_t file_map_end{0};
+  std::vector<FileMapping> file_maps{};
+
+  std::vector<uint64_t> threads{};           // 実行中のスレッドの ID
+  std::map<uint64_t, int> thread_results{}; // join 待ちの終了コード
+  WaitQueue thread_exit{};
+  bool exiting{false};
+
+  std::vector<uint64_t> children{};        // 実行中の子のアプリの ID
+  std::map<uint64_t, int> child_results{}; // wait 待ちの終了コード
+  WaitQueue child_exit{};
+
+  std::deque<AsyncIORequest> aio_queue{}; // 処理を待つ非同期 I/O
+  WaitQueue aio_submit{};
+  uint64_t aio_worker{0}; // 非同期 I/O を処理するスレッドの ID
+  uint64_t aio_next_id{1};
+};
+
 class Task {
 public:
   static const int kDefaultLevel = 1;
-  static const size_t kDefaultStackBytes = 4096;
+  static const size_t kDefaultStackBytes = kDefaultKernelStackBytes;
 
   Task(uint64_t id);
-  Task &InitContext(TaskFunc *f, int64_t data);
+  ~Task();
+  Task &InitContext(TaskFunc *f, int64_t data,
+                    size_t stack_bytes = kDefaultStackBytes);
   TaskContext &Context();
   uint64_t &OSStackPointer();
   uint64_t ID() const;
@@ -47,7 +100,7 @@ public:
 
   void SendMessage(const Message &msg);
   std::optional<Message> ReceiveMessage();
-  std::vector<std::unique_ptr<::FileDescriptor>> &Files();
+  std::vector<std::shared_ptr<::FileDescriptor>> &Files();
   uint64_t DPagingBegin() const;
   void SetDPagingBegin(uint64_t v);
   uint64_t DPagingEnd() const;
@@ -58,19 +111,39 @@ public:
 
   int Level() const { return level; }
   bool Running() const { return running; }
+  const KernelStack &Stack() const { return stack; }
+  uint64_t Runtime() const { return runtime; }
+  uint64_t VRuntime() const { return vruntime; }
+  uint64_t KernelTime() const { return runtime - stats.user_time; }
+  const TaskStats &Stats() const { return stats; }
+  void CountPageFault() { ++stats.page_faults; }
+
+  Process &Proc() { return *process; }
+  Task &ShareProcess(Task &owner);
+  bool IsThread() const { return is_thread; }
+  bool ExitRequested() const { return is_thread && process->exiting; }
+  AppEventRing *EventRing() const { return event_ring; }
+  std::unique_ptr<SyscallStatsTable> &SyscallStats() { return syscall_stats; }
+  const std::unique_ptr<SyscallStatsTable> &SyscallStats() const {
+    return syscall_stats;
+  }
 
 private:
   uint64_t id;
-  std::vector<uint64_t> stack;
+  KernelStack stack;
+  std::vector<uint8_t> ext_state_buf;
   alignas(16) TaskContext context;
   uint64_t os_stack_ptr;
   std::deque<Message> msgs;
   unsigned int level{kDefaultLevel};
   bool running{false};
-  std::vector<std::unique_ptr<::FileDescriptor>> files{};
-  uint64_t dpaging_begin{0}, dpaging_end{0};
-  uint64_t file_map_end{0};
-  std::vector<FileMapping> file_maps{};
+  uint64_t runtime{0}, vruntime{0}; // TSC カウント
+  TaskStats stats{};
+  bool user_mode{false};
+  std::shared_ptr<Process> process;
+  bool is_thread{false};
+  AppEventRing *event_ring{nullptr}; // カーネルから見たアドレス
+  std::unique_ptr<SyscallStatsTable> syscall_stats; // 計測中だけ確保する
 
   Task &SetLevel(int level) {
     this->level = level;
@@ -91,7 +164,9 @@ public:
 
   TaskManager();
   Task &NewTask();
-  void SwitchTask(const TaskContext &ctx_stack);
+  TaskSwitch SwitchTask();
+  TaskSwitch Preempt(uint64_t cs);
+  void Yield();
 
   void Sleep(Task *task);
   Error Sleep(uint64_t id);
@@ -100,19 +175,73 @@ public:
 
   Task &CurrentTask() const;
   Error SendMessage(uint64_t id, const Message &msg);
+  void SetEventRing(Task &task, AppEventRing *ring);
+  std::optional<Message> ReceiveMessage(Task &task);
+  // 取り出さずに，pred を満たすメッセージがあるかを調べる
+  template <class Pred> bool AnyMessage(const Task &task, Pred pred) const {
+    SpinLockGuard guard{lock};
+    return std::any_of(task.msgs.begin(), task.msgs.end(), pred);
+  }
+  void SetUserMode(bool user_mode);
+  // syscall の出入り口用．割り込み禁止で呼ぶ
+  void SetUserModeIRQOff(bool user_mode);
+  void Finish();
+  void Reap();
+  // 一度も起こしていないタスクを捨て，スロットを再利用できるようにする
+  void Discard(Task &task);
+
+  // レベルごとのタイムスライス（タイマ割り込みの回数）
+  int Quantum(int level) const { return quantum[level]; }
+  void SetQuantum(int level, int ticks);
+
+  // f の中で TaskManager を呼び出してはいけない
+  template <class Func> void ForEachTask(Func f) const {
+    SpinLockGuard guard{lock};
+    for (const auto &slot : slots) {
+      if (slot.task) {
+        f(*slot.task);
+      }
+    }
+  }
 
 private:
-  std::vector<std::unique_ptr<Task>> tasks;
-  uint64_t latest_id{0};
+  // タスク ID の上位 32 ビットは世代，下位 32 ビットはスロット番号
+  struct TaskSlot {
+    uint32_t generation{0};
+    std::unique_ptr<Task> task{};
+  };
+  // 割り込み禁止のまま取るので，以下のすべてのメンバを守る
+  mutable SpinLock lock;
+  std::vector<TaskSlot> slots;
+  std::vector<uint32_t> free_slots;
+  std::vector<Task *> zombies;
+
   std::array<std::deque<Task *>, kMaxLevel + 1> running{};
+  std::array<uint64_t, kMaxLevel + 1> min_vruntime{};
   int current_level{kMaxLevel};
   bool level_changed{false};
-
+  std::array<int, kMaxLevel + 1> quantum;
+  unsigned long slice_end{0};
+  uint64_t switch_tsc;
+
+  Task *RunningTask() const { return running[current_level].front(); }
+  void SetCurrentTask(Task *task);
+  void SleepLocked(Task *task, SpinLockGuard &guard);
+  void WakeupLocked(Task *task, int level);
   void ChangeLevelRunning(Task *task, int level);
+  void RequestResched();
   Task *RotateCurrentRunQueue(bool current_sleep);
+  void UpdateRuntime(Task *task);
+  void PlaceWakeup(Task *task, int level);
+  void InsertRunQueue(Task *task, int level);
+  Task &AllocateTask();
+  Task *FindTask(uint64_t id) const;
 };
 
 inline TaskManager *task_manager;
 
-__attribute__((no_caller_saved_registers)) extern "C" uint64_t
-GetCurrentTaskOSStackPointer();
+__attribute__((no_caller_saved_registers)) extern "C" void EnterSyscall();
+__attribute__((no_caller_saved_registers)) extern "C" void LeaveSyscall();
+
+__attribute__((no_caller_saved_registers)) extern "C" TaskContext *
+GetCurrentTaskContext();
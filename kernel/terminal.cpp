@@ -1,21 +1,27 @@
 #include "terminal.hpp"
 
+#include <algorithm>
 #include <cctype>
 #include <cstddef>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <limits>
 #include <memory>
 #include <optional>
+#include <tuple>
 #include <utility>
 #include <vector>
 
 #include "asmfunc.hpp"
+#include "bench.hpp"
 #include "elf.hpp"
 #include "error.hpp"
 #include "fat.hpp"
 #include "font.hpp"
 #include "graphics.hpp"
+#include "idle.hpp"
 #include "keyboard.hpp"
 #include "layer.hpp"
 #include "logger.hpp"
@@ -23,33 +29,57 @@
 #include "message.hpp"
 #include "paging.hpp"
 #include "pci.hpp"
+#include "percpu.hpp"
+#include "pipe.hpp"
+#include "syscall_stats.hpp"
 #include "task.hpp"
+#include "thread.hpp"
 #include "timer.hpp"
 #include "window.hpp"
+#include "xsave.hpp"
 
 namespace {
-WithError<int> MakeArgVector(char *command, char *first_arg, char **argv,
-                             int argv_len, char *argbuf, int argbuf_len) {
-  int argc = 0;
-  int argbuf_index = 0;
-
-  auto push_to_argv = [&](const char *s) {
-    if (argc >= argv_len || argbuf_index >= argbuf_len) {
-      return MAKE_ERROR(Error::kFull);
-    }
-
-    argv[argc] = &argbuf[argbuf_index];
-    ++argc;
-    strcpy(&argbuf[argbuf_index], s);
-    argbuf_index += strlen(s) + 1;
-    return MAKE_ERROR(Error::kSuccess);
-  };
+const int kBlinkTimerValue = 1;
+const int kTopTimerValue = 2;
+
+LockStats terminal_lock_stats{"terminal"};
+LockStats app_loads_lock_stats{"app_loads"};
+Mutex *app_loads_mutex;
+
+// アプリの引数ページは先頭に argv，その後ろに引数の文字列を置く
+const int kArgvLen = 32;
+const int kArgBufLen = 4096 - sizeof(char **) * kArgvLen;
+
+struct AppStart {
+  fat::DirectoryEntry *file_entry;
+  int argc{0};
+  int argbuf_len{0};
+  std::array<char, kArgBufLen> argbuf{}; // NUL で区切った引数
+  // 標準入出力．nullptr ならターミナルにつなぐ
+  std::array<std::shared_ptr<::FileDescriptor>, 3> stdio{};
+  Terminal *term{nullptr}; // ターミナルから起動したアプリ
+  uint64_t term_task_id{0};
+  Process *parent{nullptr}; // 他のアプリから起動したアプリ
+};
+
+Error AddArg(AppStart &start, const char *arg) {
+  const int len = strlen(arg) + 1;
+  // argv の最後には NULL を置く
+  if (start.argc >= kArgvLen - 1 || start.argbuf_len + len > kArgBufLen) {
+    return MAKE_ERROR(Error::kFull);
+  }
+  memcpy(&start.argbuf[start.argbuf_len], arg, len);
+  start.argbuf_len += len;
+  ++start.argc;
+  return MAKE_ERROR(Error::kSuccess);
+}
 
-  if (auto err = push_to_argv(command)) {
-    return {argc, err};
+Error MakeArgVector(char *command, char *first_arg, AppStart &start) {
+  if (auto err = AddArg(start, command)) {
+    return err;
   }
   if (!first_arg) {
-    return {argc, MAKE_ERROR(Error::kSuccess)};
+    return MAKE_ERROR(Error::kSuccess);
   }
 
   char *p = first_arg;
@@ -67,8 +97,8 @@ WithError<int> MakeArgVector(char *command, char *first_arg, char **argv,
     }
     const bool is_end = *p == 0;
     *p = 0;
-    if (auto err = push_to_argv(arg)) {
-      return {argc, err};
+    if (auto err = AddArg(start, arg)) {
+      return err;
     }
     if (is_end) {
       break;
@@ -76,7 +106,7 @@ WithError<int> MakeArgVector(char *command, char *first_arg, char **argv,
     ++p;
   }
 
-  return {argc, MAKE_ERROR(Error::kSuccess)};
+  return MAKE_ERROR(Error::kSuccess);
 }
 
 Elf64_Phdr *GetProgramHeader(Elf64_Ehdr *ehdr) {
@@ -183,6 +213,7 @@ void ListAllEntries(Terminal *term, uint32_t dir_cluster) {
 }
 
 WithError<AppLoadInfo> LoadApp(fat::DirectoryEntry &file_entry, Task &task) {
+  MutexGuard guard{*app_loads_mutex};
   PageMapEntry *temp_pml4;
   if (auto [pml4, err] = SetupPML4(task); err) {
     return {{}, err};
@@ -224,10 +255,185 @@ WithError<AppLoadInfo> LoadApp(fat::DirectoryEntry &file_entry, Task &task) {
   auto err = CopyPageMaps(app_load.pml4, temp_pml4, 4, 256);
   return {app_load, err};
 }
+
+bool IsRunningChild(const Process &proc, uint64_t app_id) {
+  return std::find(proc.children.begin(), proc.children.end(), app_id) !=
+         proc.children.end();
+}
+
+// 子のアプリが残っていると標準入出力を共有したままになるので，
+// 終了するアプリはすべての子が終わるのを待つ
+void WaitChildren(Task &task) {
+  __asm__("cli");
+  auto &proc = task.Proc();
+  while (!proc.children.empty()) {
+    proc.child_exit.Wait(task, 0, false);
+  }
+  proc.child_results.clear();
+  __asm__("sti");
+}
+
+WithError<int> RunApp(AppStart &start, Task &task) {
+  auto [app_load, err] = LoadApp(*start.file_entry, task);
+  if (err) {
+    return {0, err};
+  }
+
+  LinearAddress4Level args_frame_addr{0xffff'ffff'ffff'f000};
+  if (auto err = SetupPageMaps(args_frame_addr, 1)) {
+    return {0, err};
+  }
+  auto argv = reinterpret_cast<char **>(args_frame_addr.value);
+  auto argbuf = reinterpret_cast<char *>(args_frame_addr.value +
+                                         sizeof(char **) * kArgvLen);
+  memcpy(argbuf, &start.argbuf[0], start.argbuf_len);
+  for (int i = 0, off = 0; i < start.argc; ++i) {
+    argv[i] = &argbuf[off];
+    off += strlen(&argbuf[off]) + 1;
+  }
+  argv[start.argc] = nullptr;
+
+  LinearAddress4Level stack_frame_addr{0xffff'ffff'ffff'e000};
+  if (auto err = SetupPageMaps(stack_frame_addr, 1)) {
+    return {0, err};
+  }
+
+  for (auto &fd : start.stdio) {
+    if (fd) {
+      task.Files().push_back(std::move(fd));
+    } else {
+      task.Files().push_back(
+          std::make_shared<TerminalFileDescriptor>(task, *start.term));
+    }
+  }
+
+  const uint64_t elf_next_page =
+      (app_load.vaddr_end + 4095) & 0xffff'ffff'ffff'f000;
+  task.SetDPagingBegin(elf_next_page);
+  task.SetDPagingEnd(elf_next_page);
+
+  // スタックの下に 1 ページの隙間を空けて時刻のページを置き，その下から使う
+  if (auto err = MapTimePage()) {
+    return {0, err};
+  }
+  task.SetFileMapEnd(TIME_PAGE_ADDR);
+
+  task_manager->SetUserMode(true);
+  int ret = CallApp(start.argc, argv, 3 << 3 | 3, app_load.entry,
+                    stack_frame_addr.value + 4096 - 8, &task.OSStackPointer());
+  task_manager->SetUserMode(false);
+
+  StopThreads(task);
+  WaitChildren(task);
+  // リングのページは CleanPageMaps で解放されるので，先に届かなくする
+  task_manager->SetEventRing(task, nullptr);
+  task.Files().clear();
+  task.FileMaps().clear();
+
+  if (auto err = CleanPageMaps(LinearAddress4Level{0xffff'8000'0000'0000})) {
+    return {ret, err};
+  }
+  return {ret, FreePML4(task)};
+}
+
+// アプリは自分のアドレス空間を持つ専用のタスクで動かし，終了したら
+// 起動したターミナルには kAppExit で，アプリには終了コードを残して知らせる
+void TaskApp(uint64_t task_id, int64_t data) {
+  auto start = reinterpret_cast<AppStart *>(data);
+  Task &task = task_manager->CurrentTask();
+
+  auto [ret, err] = RunApp(*start, task);
+  if (err) {
+    ret = -1;
+    char s[128];
+    snprintf(s, sizeof(s), "failed to exec file: %s\n", err.Name());
+    if (start->term) {
+      start->term->Print(s);
+    } else {
+      Log(kWarn, "app %lu: %s", task_id, s);
+    }
+  }
+
+  if (start->term) {
+    Message msg{Message::kAppExit};
+    msg.src_task = task_id;
+    msg.arg.app_exit.result = ret;
+    msg.arg.app_exit.failed = err;
+    task_manager->SendMessage(start->term_task_id, msg);
+  }
+  if (auto parent = start->parent) {
+    __asm__("cli");
+    parent->children.erase(
+        std::find(parent->children.begin(), parent->children.end(), task_id));
+    parent->child_results[task_id] = ret;
+    parent->child_exit.WakeUp(std::numeric_limits<int>::max());
+    __asm__("sti");
+  }
+  delete start;
+
+  __asm__("cli");
+  task_manager->Finish();
+}
 } // namespace
 
+void InitializeAppLoads() {
+  app_loads = new std::map<fat::DirectoryEntry *, AppLoadInfo>;
+  app_loads_mutex = new Mutex{app_loads_lock_stats};
+}
+
+WithError<uint64_t>
+SpawnApp(fat::DirectoryEntry &file_entry, const char *const *argv,
+         std::array<std::shared_ptr<::FileDescriptor>, 3> stdio) {
+  Task &task = task_manager->CurrentTask();
+  std::unique_ptr<AppStart> start{new AppStart{&file_entry}};
+  for (int i = 0; argv[i]; ++i) {
+    if (auto err = AddArg(*start, argv[i])) {
+      return {0, err};
+    }
+  }
+  start->stdio = std::move(stdio);
+  start->parent = &task.Proc();
+
+  Task &app = task_manager->NewTask().InitContext(
+      TaskApp, reinterpret_cast<int64_t>(start.get()));
+  if (!app.Stack().Valid()) {
+    task_manager->Discard(app);
+    return {0, MAKE_ERROR(Error::kNoEnoughMemory)};
+  }
+  start.release();
+
+  __asm__("cli");
+  task.Proc().children.push_back(app.ID());
+  __asm__("sti");
+  app.Wakeup();
+  return {app.ID(), MAKE_ERROR(Error::kSuccess)};
+}
+
+WithError<int> WaitApp(uint64_t app_id) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  auto &proc = task.Proc();
+
+  while (IsRunningChild(proc, app_id)) {
+    if (!proc.child_exit.Wait(task)) {
+      __asm__("sti");
+      return {0, MAKE_ERROR(Error::kInterrupted)};
+    }
+  }
+
+  auto it = proc.child_results.find(app_id);
+  if (it == proc.child_results.end()) {
+    __asm__("sti");
+    return {0, MAKE_ERROR(Error::kNoSuchTask)};
+  }
+  const int result = it->second;
+  proc.child_results.erase(it);
+  __asm__("sti");
+  return {result, MAKE_ERROR(Error::kSuccess)};
+}
+
 Terminal::Terminal(uint64_t task_id, bool show_window)
-    : task_id{task_id}, show_window{show_window} {
+    : task_id{task_id}, show_window{show_window}, mutex{terminal_lock_stats} {
   if (show_window) {
     window = std::make_shared<ToplevelWindow>(
         kColumns * 8 + 8 + ToplevelWindow::kMarginX,
@@ -244,6 +450,7 @@ Terminal::Terminal(uint64_t task_id, bool show_window)
 }
 
 Rectangle<int> Terminal::BlinkCursor() {
+  MutexGuard guard{mutex};
   cursor_visible = !cursor_visible;
   DrawCursor(cursor_visible);
 
@@ -264,6 +471,7 @@ Vector2D<int> Terminal::CalcCursorPos() const {
 
 Rectangle<int> Terminal::InputKey(uint8_t modifier, uint8_t keycode,
                                   char ascii) {
+  MutexGuard guard{mutex};
   DrawCursor(false);
 
   Rectangle<int> draw_area{CalcCursorPos(), {8 * 2, 16}};
@@ -283,8 +491,14 @@ Rectangle<int> Terminal::InputKey(uint8_t modifier, uint8_t keycode,
     } else {
       Scroll1();
     }
+    // コマンドの実行中もアプリのタスクが出力できるようにする
+    mutex.Unlock();
     ExecuteLine();
-    Print(">");
+    mutex.Lock();
+    // フォアグラウンドのアプリがあれば，終了したときにプロンプトを出す
+    if (fg_task == 0) {
+      Print(">");
+    }
     draw_area.pos = ToplevelWindow::kTopLeftMargin;
     draw_area.size = window->InnerSize();
   } else if (ascii == '\b') {
@@ -353,6 +567,7 @@ void Terminal::Print(char c) {
 }
 
 void Terminal::Print(const char *s, std::optional<size_t> len) {
+  MutexGuard guard{mutex};
   const auto cursor_before = CalcCursorPos();
   DrawCursor(false);
 
@@ -378,12 +593,34 @@ void Terminal::Print(const char *s, std::optional<size_t> len) {
 
   Message msg =
       MakeLayerMessage(task_id, LayerID(), LayerOperation::DrawArea, draw_area);
-  __asm__("cli");
   task_manager->SendMessage(1, msg);
-  __asm__("sti");
 }
 
 void Terminal::ExecuteLine() {
+  // 末尾の & はアプリをバックグラウンドで動かす
+  bool background = false;
+  int len = strlen(&linebuf[0]);
+  while (len > 0 && isspace(linebuf[len - 1])) {
+    --len;
+  }
+  if (len > 0 && linebuf[len - 1] == '&') {
+    background = true;
+    --len;
+    while (len > 0 && isspace(linebuf[len - 1])) {
+      --len;
+    }
+  }
+  linebuf[len] = 0;
+
+  if (strchr(&linebuf[0], '|')) {
+    if (auto err = ExecutePipeline(&linebuf[0], background)) {
+      Print("failed to exec pipeline: ");
+      Print(err.Name());
+      Print("\n");
+    }
+    return;
+  }
+
   char *command = &linebuf[0];
   char *first_arg = strchr(&linebuf[0], ' ');
   if (first_arg) {
@@ -396,12 +633,13 @@ void Terminal::ExecuteLine() {
       Print(first_arg);
     }
     Print("\n");
-  } else if (strcmp(command, "clear") == 0) {
-    if (show_window) {
-      FillRectangle(*window->InnerWriter(), {4, 4}, {8 * kColumns, 16 * kRows},
-                    ToColor(0));
+  } else if (strcmp(command, "exit") == 0) {
+    exit_requested = true;
+    if (HasJobs()) {
+      Print("waiting for background jobs to finish\n");
     }
-    cursor.y = 0;
+  } else if (strcmp(command, "clear") == 0) {
+    Clear();
   } else if (strcmp(command, "lspci") == 0) {
     char s[64];
     for (int i = 0; i < pci::num_device; ++i) {
@@ -480,6 +718,187 @@ void Terminal::ExecuteLine() {
     sprintf(s, "Phys total: %lu frames (%llu MiB)\n", p_stat.total_frames,
             p_stat.total_frames * kBytesPerFrame / 1024 / 1024);
     Print(s);
+  } else if (strcmp(command, "ps") == 0) {
+    struct TaskStat {
+      uint64_t id;
+      int level;
+      bool running;
+      size_t stack_bytes, stack_used;
+      uint64_t runtime;
+    };
+    std::vector<TaskStat> stats;
+
+    task_manager->ForEachTask([&stats](const Task &task) {
+      stats.push_back({task.ID(), task.Level(), task.Running(),
+                       task.Stack().bytes,
+                       kernel_stack_allocator->HighWaterMark(task.Stack()),
+                       task.Runtime()});
+    });
+
+    char s[128];
+    Print("  ID LV R  STACK   USED  TIME(ms)\n");
+    for (const auto &stat : stats) {
+      snprintf(s, sizeof(s), "%4lu %2d %c %6lu %6lu %9lu\n", stat.id,
+               stat.level, stat.running ? 'R' : 'S', stat.stack_bytes,
+               stat.stack_used, stat.runtime * 1000 / tsc_freq);
+      Print(s);
+    }
+  } else if (strcmp(command, "top") == 0) {
+    const int seconds = first_arg ? atoi(first_arg) : 0;
+    RunTop(kTimerFreq * (seconds > 0 ? seconds : 1));
+  } else if (strcmp(command, "ctxbench") == 0) {
+    const int iterations = first_arg ? atoi(first_arg) : 10000;
+    const auto res = BenchContextSwitch(iterations > 0 ? iterations : 10000);
+
+    static const char *const kModeNames[] = {"fxsave", "xsave", "xsaveopt"};
+    char s[128];
+    snprintf(s, sizeof(s), "%lu switches: %lu cycles/switch\n", res.switches,
+             res.cycles / res.switches);
+    Print(s);
+    snprintf(s, sizeof(s), "ext state: %s, %lu bytes, xcr0=%#lx\n",
+             kModeNames[ext_state_mode], ext_state_size, ext_state_xcr0);
+    Print(s);
+  } else if (strcmp(command, "quantum") == 0) {
+    // quantum [level ms]
+    if (first_arg) {
+      char *ms_arg;
+      const long level = strtol(first_arg, &ms_arg, 10);
+      const long ms = strtol(ms_arg, nullptr, 10);
+      if (level < 0 || level > TaskManager::kMaxLevel || ms <= 0) {
+        Print("usage: quantum [level ms]\n");
+      } else {
+        task_manager->SetQuantum(level, ms * kTimerFreq / 1000);
+      }
+    }
+    char s[128];
+    for (int lv = 0; lv <= TaskManager::kMaxLevel; ++lv) {
+      snprintf(s, sizeof(s), "level %d: %d ms\n", lv,
+               task_manager->Quantum(lv) * 1000 / kTimerFreq);
+      Print(s);
+    }
+  } else if (strcmp(command, "idlestat") == 0) {
+    // idlestat [hlt|c<N>]
+    if (first_arg) {
+      int cstate = -1;
+      if (strcmp(first_arg, "hlt") == 0) {
+        cstate = 0;
+      } else if (first_arg[0] == 'c') {
+        cstate = atoi(first_arg + 1);
+      }
+      if (cstate < 0 || !SetIdleCState(cstate)) {
+        Print("unsupported idle state\n");
+      }
+    }
+
+    const auto &idle = ThisCPU().idle;
+    char s[128];
+    if (IdleCState() == 0) {
+      snprintf(s, sizeof(s), "mode: hlt\n");
+    } else {
+      snprintf(s, sizeof(s), "mode: mwait C%d (hint %#x)\n", IdleCState(),
+               mwait_hint);
+    }
+    Print(s);
+    snprintf(s, sizeof(s), "entries: %lu, idle: %lu ms, IPIs saved: %lu\n",
+             idle.entries, idle.idle_tsc * 1000 / tsc_freq, idle.ipi_saved);
+    Print(s);
+  } else if (strcmp(command, "idlebench") == 0) {
+    const int arg = first_arg ? atoi(first_arg) : 0;
+    const auto res = BenchIdleWakeup(arg > 0 ? arg : 200);
+
+    char s[128];
+    snprintf(s, sizeof(s), "%d wakeups: avg %lu, max %lu cycles from tick\n",
+             res.samples, res.total_cycles / res.samples, res.max_cycles);
+    Print(s);
+    snprintf(s, sizeof(s), "idle %lu%% of %lu ms\n",
+             res.idle_cycles * 100 / res.elapsed_cycles,
+             res.elapsed_cycles * 1000 / tsc_freq);
+    Print(s);
+  } else if (strcmp(command, "lockstat") == 0) {
+    Print("NAME                 ACQUIRED  CONTENDED  MAX HOLD(us)\n");
+    ForEachLockStats([this](const LockStats &stats) {
+      char s[128];
+      snprintf(s, sizeof(s), "%-16s %12lu %10lu %13lu\n", stats.name,
+               stats.acquisitions, stats.contentions,
+               stats.max_hold_tsc * 1000000 / tsc_freq);
+      Print(s);
+    });
+  } else if (strcmp(command, "sysstat") == 0) {
+    std::vector<char> text;
+    if (first_arg == nullptr) {
+      text = FormatSyscallStats();
+    } else if (strcmp(first_arg, "on") == 0 || strcmp(first_arg, "off") == 0) {
+      syscall_stats_enabled = strcmp(first_arg, "on") == 0;
+    } else if (strcmp(first_arg, "reset") == 0) {
+      ResetSyscallStats();
+    } else if (isdigit(first_arg[0])) {
+      text = FormatSyscallStats(strtoul(first_arg, nullptr, 0));
+    } else {
+      size_t num = 0;
+      while (num < kNumSyscalls && strcmp(SyscallName(num), first_arg) != 0) {
+        ++num;
+      }
+      if (num == kNumSyscalls) {
+        Print("usage: sysstat [on|off|reset|<task id>|<syscall name>]\n");
+      } else {
+        text = FormatSyscallHistogram(num);
+      }
+    }
+    Print(text.data(), text.size());
+  } else if (strcmp(command, "workq") == 0) {
+    Print("NAME   PROCESSED BACKLOG  MAX  DROP YIELD  AVG(us)  MAX(us)\n");
+    for (auto queue : ThisCPU().workqueues) {
+      const auto &stats = queue->Stats();
+      const uint64_t avg_latency =
+          stats.processed ? stats.total_latency_tsc / stats.processed : 0;
+      char s[128];
+      snprintf(s, sizeof(s), "%-6s %9lu %7u %4lu %5lu %5lu %8lu %8lu\n",
+               queue->Name(), stats.processed, queue->Backlog(),
+               stats.max_backlog, stats.dropped, stats.yields,
+               avg_latency * 1000000 / tsc_freq,
+               stats.max_latency_tsc * 1000000 / tsc_freq);
+      Print(s);
+    }
+  } else if (strcmp(command, "preemptbench") == 0) {
+    const int arg = first_arg ? atoi(first_arg) : 0;
+    const auto res = BenchPreemption(arg > 0 ? arg : 100);
+
+    char s[128];
+    snprintf(s, sizeof(s), "%d preemptions: avg %lu, min %lu cycles/switch\n",
+             res.switches, res.switch_cycles / res.switches,
+             res.min_switch_cycles);
+    Print(s);
+    if (res.ticks > 0) {
+      snprintf(s, sizeof(s), "%d ticks without switch: avg %lu cycles\n",
+               res.ticks, res.tick_cycles / res.ticks);
+      Print(s);
+    }
+  } else if (strcmp(command, "latbench") == 0) {
+    const int arg = first_arg ? atoi(first_arg) : 0;
+    const int samples = arg > 0 ? arg : 300;
+
+    // cube, stars, busy をデフォルトのレベルで動かしながら，
+    // 受信側が負荷と同じレベルの場合と 1 つ上のレベルの場合を計測する
+    static char cube_cmd[32], busy_cmd[32];
+    const int seconds = 2 * samples / kTimerFreq + 2;
+    sprintf(cube_cmd, "cube %d", seconds * 20);
+    sprintf(busy_cmd, "busy %d", seconds);
+    const char *loads[] = {cube_cmd, "stars 100000", busy_cmd};
+    for (const char *cmd : loads) {
+      task_manager->NewTask()
+          .InitContext(TaskTerminal, reinterpret_cast<int64_t>(cmd))
+          .Wakeup();
+    }
+
+    for (int level : {Task::kDefaultLevel, Task::kDefaultLevel + 1}) {
+      const auto res = BenchWakeupLatency(samples, level);
+      char s[128];
+      snprintf(s, sizeof(s), "level %d, %d samples: avg %lu us, max %lu us\n",
+               level, res.samples,
+               res.total_cycles / res.samples * 1000000 / tsc_freq,
+               res.max_cycles * 1000000 / tsc_freq);
+      Print(s);
+    }
   } else if (command[0] != 0) {
     auto [file_entry, post_slash] = fat::FindFile(command);
     if (!file_entry) {
@@ -491,7 +910,8 @@ void Terminal::ExecuteLine() {
       fat::FormatName(*file_entry, name);
       Print(name);
       Print(" is not a directory\n");
-    } else if (auto err = ExecuteFile(*file_entry, command, first_arg)) {
+    } else if (auto err =
+                   ExecuteFile(*file_entry, command, first_arg, background)) {
       Print("failed to exec file: ");
       Print(err.Name());
       Print("\n");
@@ -499,64 +919,273 @@ void Terminal::ExecuteLine() {
   }
 }
 
-Error Terminal::ExecuteFile(fat::DirectoryEntry &file_entry, char *command,
-                            char *first_arg) {
-  __asm__("cli");
-  auto &task = task_manager->CurrentTask();
-  __asm__("sti");
+void Terminal::Clear() {
+  MutexGuard guard{mutex};
+  if (show_window) {
+    FillRectangle(*window->InnerWriter(), {4, 4}, {8 * kColumns, 16 * kRows},
+                  ToColor(0));
+  }
+  cursor = {0, 0};
+}
 
-  auto [app_load, err] = LoadApp(file_entry, task);
-  if (err) {
-    return err;
+void Terminal::RunTop(unsigned long interval) {
+  struct TaskSnapshot {
+    uint64_t id;
+    int level;
+    bool running;
+    uint64_t runtime, user_time, kernel_time;
+    TaskStats stats;
+  };
+  auto take_snapshot = []() {
+    std::vector<TaskSnapshot> snapshot;
+    task_manager->ForEachTask([&snapshot](const Task &task) {
+      snapshot.push_back({task.ID(), task.Level(), task.Running(),
+                          task.Runtime(), task.Stats().user_time,
+                          task.KernelTime(), task.Stats()});
+    });
+    return snapshot;
+  };
+
+  Task &task = task_manager->CurrentTask();
+
+  auto prev = take_snapshot();
+  uint64_t prev_tsc = ReadTSC();
+  unsigned long timeout = timer_manager->CurrentTick();
+
+  while (true) {
+    timeout += interval;
+    timer_manager->AddTimer(Timer{timeout, kTopTimerValue, task_id});
+
+    // q が押されるまで interval ごとに表示を更新する
+    while (true) {
+      __asm__("cli");
+      auto msg = task.ReceiveMessage();
+      if (!msg) {
+        task.Sleep();
+        __asm__("sti");
+        continue;
+      }
+      __asm__("sti");
+
+      if (msg->type == Message::kAppExit) {
+        FinishApp(*msg);
+      } else if (msg->type == Message::kKeyPush && msg->arg.keyboard.press &&
+                 msg->arg.keyboard.ascii == 'q') {
+        Print("\n");
+        return;
+      } else if (msg->type != Message::kTimerTimeout) {
+        continue;
+      } else if (msg->arg.timer.value == kTopTimerValue) {
+        break;
+      } else if (msg->arg.timer.value == kBlinkTimerValue) {
+        timer_manager->AddTimer(Timer{msg->arg.timer.timeout + kTimerFreq / 2,
+                                      kBlinkTimerValue, task_id});
+      }
+    }
+
+    auto cur = take_snapshot();
+    const uint64_t cur_tsc = ReadTSC();
+    const uint64_t elapsed = cur_tsc - prev_tsc;
+
+    struct Row {
+      const TaskSnapshot *task;
+      uint64_t cpu_permille;
+    };
+    std::vector<Row> rows;
+    for (const auto &t : cur) {
+      uint64_t prev_runtime = 0;
+      for (const auto &p : prev) {
+        if (p.id == t.id) {
+          prev_runtime = p.runtime;
+          break;
+        }
+      }
+      rows.push_back({&t, (t.runtime - prev_runtime) * 1000 / elapsed});
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+      return a.cpu_permille > b.cpu_permille;
+    });
+
+    Clear();
+    char s[128];
+    Print("  ID LV R  CPU%  USER(ms)  SYS(ms)   VCSW   ICSW    PF\n");
+    for (int i = 0; i < rows.size() && i < kRows - 2; ++i) {
+      const auto &t = *rows[i].task;
+      snprintf(s, sizeof(s), "%4lu %2d %c %3lu.%lu %9lu %8lu %6lu %6lu %5lu\n",
+               t.id, t.level, t.running ? 'R' : 'S', rows[i].cpu_permille / 10,
+               rows[i].cpu_permille % 10, t.user_time * 1000 / tsc_freq,
+               t.kernel_time * 1000 / tsc_freq, t.stats.voluntary_switches,
+               t.stats.involuntary_switches, t.stats.page_faults);
+      Print(s);
+    }
+    Print("q: quit");
+
+    prev = std::move(cur);
+    prev_tsc = cur_tsc;
   }
+}
 
-  LinearAddress4Level args_frame_addr{0xffff'ffff'ffff'f000};
-  if (auto err = SetupPageMaps(args_frame_addr, 1)) {
-    return err;
+WithError<uint64_t>
+Terminal::StartApp(fat::DirectoryEntry &file_entry, char *command,
+                   char *first_arg,
+                   std::array<std::shared_ptr<::FileDescriptor>, 3> stdio) {
+  std::unique_ptr<AppStart> start{new AppStart{&file_entry}};
+  if (auto err = MakeArgVector(command, first_arg, *start)) {
+    return {0, err};
   }
-  auto argv = reinterpret_cast<char **>(args_frame_addr.value);
-  int argv_len = 32;
-  auto argbuf = reinterpret_cast<char *>(args_frame_addr.value +
-                                         sizeof(char **) * argv_len);
-  int argbuf_len = 4096 - sizeof(char **) * argv_len;
-  auto argc =
-      MakeArgVector(command, first_arg, argv, argv_len, argbuf, argbuf_len);
-  if (argc.error) {
-    return argc.error;
+  start->stdio = std::move(stdio);
+  start->term = this;
+  start->term_task_id = task_id;
+
+  Task &app = task_manager->NewTask().InitContext(
+      TaskApp, reinterpret_cast<int64_t>(start.get()));
+  if (!app.Stack().Valid()) {
+    task_manager->Discard(app);
+    return {0, MAKE_ERROR(Error::kNoEnoughMemory)};
   }
+  start.release();
 
-  LinearAddress4Level stack_frame_addr{0xffff'ffff'ffff'e000};
-  if (auto err = SetupPageMaps(stack_frame_addr, 1)) {
+  jobs.push_back(app.ID());
+  app.Wakeup();
+  return {app.ID(), MAKE_ERROR(Error::kSuccess)};
+}
+
+Error Terminal::ExecuteFile(fat::DirectoryEntry &file_entry, char *command,
+                            char *first_arg, bool background) {
+  auto [app_id, err] = StartApp(file_entry, command, first_arg, {});
+  if (err) {
     return err;
   }
 
-  for (int i = 0; i < 3; ++i) {
-    task.Files().push_back(
-        std::make_unique<TerminalFileDescriptor>(task, *this));
+  if (background) {
+    char s[128];
+    snprintf(s, sizeof(s), "[%lu]\n", app_id);
+    Print(s);
+  } else {
+    fg_task = input_task = app_id;
   }
+  return MAKE_ERROR(Error::kSuccess);
+}
 
-  const uint64_t elf_next_page =
-      (app_load.vaddr_end + 4095) & 0xffff'ffff'ffff'f000;
-  task.SetDPagingBegin(elf_next_page);
-  task.SetDPagingEnd(elf_next_page);
+Error Terminal::ExecutePipeline(char *line, bool background) {
+  struct Stage {
+    fat::DirectoryEntry *file_entry;
+    char *command, *first_arg;
+  };
+  std::vector<Stage> stages;
 
-  task.SetFileMapEnd(0xffff'ffff'ffff'e000);
+  // すべての段のコマンドが見つかってから起動する
+  for (char *p = line; p;) {
+    char *next = strchr(p, '|');
+    if (next) {
+      *next++ = 0;
+    }
+    while (isspace(*p)) {
+      ++p;
+    }
+    for (int len = strlen(p); len > 0 && isspace(p[len - 1]); --len) {
+      p[len - 1] = 0;
+    }
+    if (*p == 0) {
+      Print("empty command in pipeline\n");
+      return MAKE_ERROR(Error::kSuccess);
+    }
 
-  int ret = CallApp(argc.value, argv, 3 << 3 | 3, app_load.entry,
-                    stack_frame_addr.value + 4096 - 8, &task.OSStackPointer());
+    char *first_arg = strchr(p, ' ');
+    if (first_arg) {
+      *first_arg++ = 0;
+    }
+    auto [file_entry, post_slash] = fat::FindFile(p);
+    if (!file_entry || file_entry->attr == fat::Attribute::kDirectory ||
+        post_slash) {
+      Print("no such command: ");
+      Print(p);
+      Print("\n");
+      return MAKE_ERROR(Error::kSuccess);
+    }
+    stages.push_back({file_entry, p, first_arg});
+    p = next;
+  }
 
-  task.Files().clear();
-  task.FileMaps().clear();
+  // 起動したら参照を手放し，パイプの両端をアプリだけが持つようにする
+  std::shared_ptr<::FileDescriptor> prev_read;
+  uint64_t first_id = 0, last_id = 0;
+  auto err = MAKE_ERROR(Error::kSuccess);
+  for (size_t i = 0; i < stages.size(); ++i) {
+    std::array<std::shared_ptr<::FileDescriptor>, 3> stdio{};
+    stdio[0] = std::move(prev_read);
+    if (i + 1 < stages.size()) {
+      std::tie(prev_read, stdio[1]) = MakePipe();
+    }
 
-  char s[64];
-  sprintf(s, "app exited. ret = %d\n", ret);
-  Print(s);
+    auto &stage = stages[i];
+    auto [app_id, start_err] = StartApp(*stage.file_entry, stage.command,
+                                        stage.first_arg, std::move(stdio));
+    if (start_err) {
+      err = start_err;
+      break;
+    }
+    if (i == 0) {
+      first_id = app_id;
+    }
+    if (i + 1 < stages.size() && !background) {
+      pipe_jobs.push_back(app_id);
+    }
+    last_id = app_id;
+  }
+  prev_read.reset();
 
-  if (auto err = CleanPageMaps(LinearAddress4Level{0xffff'8000'0000'0000})) {
+  // 途中の段で失敗しても，起動できた段はそこまでのパイプラインとして扱い，
+  // 最後の段の終了を待てるようにする．残りの段への出力は失敗する
+  if (last_id == 0) {
     return err;
   }
+  if (background) {
+    char s[128];
+    snprintf(s, sizeof(s), "[%lu]\n", last_id);
+    Print(s);
+  } else {
+    pipe_jobs.erase(std::remove(pipe_jobs.begin(), pipe_jobs.end(), last_id),
+                    pipe_jobs.end());
+    fg_task = last_id;
+    input_task = first_id;
+  }
+  return err;
+}
 
-  return FreePML4(task);
+void Terminal::SetStdinReader(uint64_t owner, uint64_t reader) {
+  // バックグラウンドのアプリが読んでもキー入力は横取りさせない
+  if (owner == input_task) {
+    stdin_reader = owner == reader ? 0 : reader;
+  }
+}
+
+void Terminal::FinishApp(const Message &msg) {
+  const uint64_t app_id = msg.src_task;
+  auto it = std::find(jobs.begin(), jobs.end(), app_id);
+  if (it == jobs.end()) {
+    return;
+  }
+  jobs.erase(it);
+  if (auto p = std::find(pipe_jobs.begin(), pipe_jobs.end(), app_id);
+      p != pipe_jobs.end()) {
+    pipe_jobs.erase(p);
+    return;
+  }
+
+  char s[128];
+  if (app_id == fg_task) {
+    fg_task = input_task = stdin_reader = 0;
+    if (!msg.arg.app_exit.failed) {
+      sprintf(s, "app exited. ret = %d\n", msg.arg.app_exit.result);
+      Print(s);
+    }
+    Print(">");
+  } else {
+    snprintf(s, sizeof(s), "[%lu] done. ret = %d\n", app_id,
+             msg.arg.app_exit.result);
+    Print(s);
+  }
 }
 
 Rectangle<int> Terminal::HistoryUpDown(int direction) {
@@ -590,15 +1219,14 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
   const char *command_line = reinterpret_cast<char *>(data);
   const bool show_window = command_line == nullptr;
 
-  __asm__("cli");
   Task &task = task_manager->CurrentTask();
   Terminal *terminal = new Terminal{task_id, show_window};
   if (show_window) {
+    MutexGuard guard{layer_manager->GetMutex()};
     layer_manager->Move(terminal->LayerID(), {100, 200});
     active_layer->Activate(terminal->LayerID());
     layer_task_map->insert(std::make_pair(terminal->LayerID(), task_id));
   }
-  __asm__("sti");
 
   if (command_line) {
     for (const char *p = command_line; *p; ++p) {
@@ -608,14 +1236,16 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
   }
 
   auto add_blink_timer = [task_id](unsigned long t) {
-    timer_manager->AddTimer(
-        Timer{t + static_cast<int>(kTimerFreq * 0.5), 1, task_id});
+    timer_manager->AddTimer(Timer{t + static_cast<int>(kTimerFreq * 0.5),
+                                  kBlinkTimerValue, task_id});
   };
   add_blink_timer(timer_manager->CurrentTick());
 
   bool window_isactive = false;
 
-  while (true) {
+  // ウィンドウを持たないターミナルはコマンドを 1 つ実行したら終了する．
+  // 起動したアプリがあれば，すべて終了するまで待つ
+  while ((show_window && !terminal->ExitRequested()) || terminal->HasJobs()) {
     __asm__("cli");
     auto msg = task.ReceiveMessage();
     if (!msg) {
@@ -627,28 +1257,35 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
 
     switch (msg->type) {
     case Message::kTimerTimeout: {
+      if (msg->arg.timer.value != kBlinkTimerValue) {
+        break;
+      }
       add_blink_timer(msg->arg.timer.timeout);
       if (show_window && window_isactive) {
         const auto area = terminal->BlinkCursor();
         Message msg = MakeLayerMessage(task_id, terminal->LayerID(),
                                        LayerOperation::DrawArea, area);
-        __asm__("cli");
         task_manager->SendMessage(1, msg);
-        __asm__("sti");
       }
       break;
     }
     case Message::kKeyPush: {
-      if (msg->arg.keyboard.press) {
+      if (auto fg_task = terminal->ForegroundTask()) {
+        if (task_manager->SendMessage(fg_task, *msg)) {
+          terminal->ResetStdinReader();
+          task_manager->SendMessage(terminal->ForegroundTask(), *msg);
+        }
+      } else if (msg->arg.keyboard.press) {
         const auto area = terminal->InputKey(msg->arg.keyboard.modifier,
                                              msg->arg.keyboard.keycode,
                                              msg->arg.keyboard.ascii);
         if (show_window) {
           Message msg = MakeLayerMessage(task_id, terminal->LayerID(),
                                          LayerOperation::DrawArea, area);
-          __asm__("cli");
           task_manager->SendMessage(1, msg);
-          __asm__("sti");
+        }
+        if (key_echo_hook) {
+          key_echo_hook(task_id, msg->arg.keyboard.keycode);
         }
       }
       break;
@@ -656,23 +1293,53 @@ void TaskTerminal(uint64_t task_id, int64_t data) {
     case Message::kWindowActive:
       window_isactive = msg->arg.window_active.activate;
       break;
+    case Message::kAppExit:
+      terminal->FinishApp(*msg);
+      break;
     default:
       break;
     }
   }
+
+  if (show_window) {
+    const auto layer_id = terminal->LayerID();
+    MutexGuard guard{layer_manager->GetMutex()};
+    const auto layer = layer_manager->FindLayer(layer_id);
+    const auto layer_pos = layer->GetPosition();
+    const auto win_size = layer->GetWindow()->Size();
+
+    active_layer->Activate(0);
+    layer_manager->RemoveLayer(layer_id);
+    layer_manager->Draw({layer_pos, win_size});
+    layer_task_map->erase(layer_id);
+  }
+  delete terminal;
+
+  __asm__("cli");
+  task_manager->Finish();
 }
 
 TerminalFileDescriptor::TerminalFileDescriptor(Task &task, Terminal &term)
-    : task(task), term(term) {}
+    : owner(task.ID()), term(term) {}
 
+// 標準入力を引き継いだ子のアプリも読むので，キー入力は読んでいるタスクに
+// 届けてもらい，そのタスクのメッセージから取り出す
 size_t TerminalFileDescriptor::Read(void *buf, size_t len) {
   char *bufc = reinterpret_cast<char *>(buf);
+  Task &reader = task_manager->CurrentTask();
+  term.SetStdinReader(owner, reader.ID());
 
   while (true) {
     __asm__("cli");
-    auto msg = task.ReceiveMessage();
+    auto msg = reader.ReceiveMessage();
     if (!msg) {
-      task.Sleep();
+      // アプリの終了を待つ StopThreads に起こされたスレッドは眠り直さない
+      if (reader.ExitRequested()) {
+        __asm__("sti");
+        return 0;
+      }
+      reader.Sleep();
+      __asm__("sti");
       continue;
     }
     __asm__("sti");
@@ -696,6 +1363,23 @@ size_t TerminalFileDescriptor::Read(void *buf, size_t len) {
   }
 }
 
+// キー入力のメッセージが届くとタスクが起こされるので，待ち行列は要らない
+int TerminalFileDescriptor::PollEvents() {
+  Task &reader = task_manager->CurrentTask();
+  term.SetStdinReader(owner, reader.ID());
+  // Read が読み飛ばさずに返すキー（文字か Ctrl-D）が届いているか
+  auto is_input = [](const Message &msg) {
+    if (msg.type != Message::kKeyPush || !msg.arg.keyboard.press) {
+      return false;
+    }
+    const bool ctrl =
+        msg.arg.keyboard.modifier & (kLControlBitMask | kRControlBitMask);
+    return !ctrl || msg.arg.keyboard.keycode == 7 /* D */;
+  };
+  const bool readable = task_manager->AnyMessage(reader, is_input);
+  return POLLOUT | (readable ? POLLIN : 0);
+}
+
 size_t TerminalFileDescriptor::Write(const void *buf, size_t len) {
   term.Print(reinterpret_cast<const char *>(buf), len);
   return len;
@@ -5,10 +5,12 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include "fat.hpp"
 #include "file.hpp"
 #include "graphics.hpp"
+#include "lock.hpp"
 #include "paging.hpp"
 #include "task.hpp"
 #include "window.hpp"
@@ -20,19 +22,46 @@ public:
 
   Terminal(uint64_t task_id, bool show_window);
   unsigned int LayerID() const { return layer_id; }
+  bool ExitRequested() const { return exit_requested; }
+  bool HasJobs() const { return !jobs.empty(); }
+  // キー入力を渡すフォアグラウンドのアプリ．なければ 0
+  uint64_t ForegroundTask() const {
+    return fg_task ? (stdin_reader ? stdin_reader : input_task) : 0;
+  }
+  // owner のタスクに渡した端末の fd を reader のタスクが読む．
+  // 標準入力を引き継いだ子のアプリにキー入力を届けるのに使う
+  void SetStdinReader(uint64_t owner, uint64_t reader);
+  // 端末を読んでいたタスクが終了したので，キー入力を input_task に戻す
+  void ResetStdinReader() { stdin_reader = 0; }
   Rectangle<int> BlinkCursor();
   Rectangle<int> InputKey(uint8_t modifier, uint8_t keycode, char ascii);
   void Print(char c);
   void Print(const char *s, std::optional<size_t> len = std::nullopt);
   void ExecuteLine();
   Error ExecuteFile(fat::DirectoryEntry &file_entry, char *command,
-                    char *first_arg);
+                    char *first_arg, bool background);
+  // "a | b | c" のように，各段の標準出力を次の段の標準入力にパイプでつなぐ
+  Error ExecutePipeline(char *line, bool background);
+  void FinishApp(const Message &msg);
 
 private:
   std::shared_ptr<ToplevelWindow> window;
   unsigned int layer_id;
   uint64_t task_id;
   bool show_window;
+  bool exit_requested{false};
+
+  // アプリのタスクも出力するので，画面とカーソルの更新を守る
+  Mutex mutex;
+  std::vector<uint64_t> jobs{}; // 実行中のアプリのタスク ID
+  uint64_t fg_task{0};          // パイプラインなら最後の段
+  uint64_t input_task{0};       // パイプラインなら最初の段
+  uint64_t stdin_reader{0};     // 最後に端末を読んだ input_task の子孫
+  // フォアグラウンドのパイプラインの途中の段．終了しても表示しない
+  std::vector<uint64_t> pipe_jobs{};
+  WithError<uint64_t>
+  StartApp(fat::DirectoryEntry &file_entry, char *command, char *first_arg,
+           std::array<std::shared_ptr<::FileDescriptor>, 3> stdio);
 
   Vector2D<int> cursor{0, 0};
   bool cursor_visible{false};
@@ -42,6 +71,8 @@ private:
   int linebuf_index{0};
   std::array<char, kLineMax> linebuf{};
   void Scroll1();
+  void Clear();
+  void RunTop(unsigned long interval);
 
   std::deque<std::array<char, kLineMax>> cmd_history{};
   int cmd_history_index{-1};
@@ -57,9 +88,17 @@ public:
   size_t Write(const void *buf, size_t len) override;
   size_t Size() const override;
   size_t Load(void *buf, size_t len, size_t offset) override;
+  // キー入力はアプリのタスクへのメッセージとして届く
+  bool AsyncReadable() const override { return false; }
+  int PollEvents() override;
+  void Stat(FileStat &st) const override {
+    st = FileStat{0, 0, FileStat::kTerminal};
+  }
 
 private:
-  Task &task;
+  // この fd を渡したアプリのタスク ID．fd は子のアプリと共有することがあり，
+  // そのアプリより長く残りうるので Task への参照は持たない
+  uint64_t owner;
   Terminal &term;
 };
 
@@ -69,3 +108,11 @@ struct AppLoadInfo {
 };
 
 inline std::map<fat::DirectoryEntry *, AppLoadInfo> *app_loads;
+void InitializeAppLoads();
+
+// 実行中のアプリから子のアプリを起動する．argv は nullptr で終わる
+WithError<uint64_t>
+SpawnApp(fat::DirectoryEntry &file_entry, const char *const *argv,
+         std::array<std::shared_ptr<::FileDescriptor>, 3> stdio);
+// 子のアプリの終了を待ち，終了コードを返す
+WithError<int> WaitApp(uint64_t app_id);
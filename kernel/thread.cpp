@@ -0,0 +1,104 @@
+#include "thread.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "asmfunc.hpp"
+#include "logger.hpp"
+
+namespace {
+struct ThreadStart {
+  uint64_t entry, stack_top, arg;
+};
+
+void TaskThread(uint64_t task_id, int64_t data) {
+  const auto start = *reinterpret_cast<ThreadStart *>(data);
+  delete reinterpret_cast<ThreadStart *>(data);
+
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  task_manager->SetUserMode(true);
+  __asm__("sti");
+
+  // スレッドの入口には RDI にスレッド ID，RSI に引数を渡す
+  const int ret = CallApp(task_id, reinterpret_cast<char **>(start.arg),
+                          3 << 3 | 3, start.entry, start.stack_top,
+                          &task.OSStackPointer());
+
+  __asm__("cli");
+  task_manager->SetUserMode(false);
+  auto &proc = task.Proc();
+  proc.threads.erase(
+      std::find(proc.threads.begin(), proc.threads.end(), task_id));
+  proc.thread_results[task_id] = ret;
+  proc.thread_exit.WakeUp(std::numeric_limits<int>::max());
+  task_manager->Finish();
+}
+
+bool IsRunningThread(const Process &proc, uint64_t thread_id) {
+  return std::find(proc.threads.begin(), proc.threads.end(), thread_id) !=
+         proc.threads.end();
+}
+} // namespace
+
+WithError<uint64_t> CreateThread(uint64_t entry, uint64_t stack_top,
+                                 uint64_t arg) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  __asm__("sti");
+
+  auto start = new ThreadStart{entry, stack_top, arg};
+  Task &thread = task_manager->NewTask()
+                     .InitContext(TaskThread, reinterpret_cast<int64_t>(start))
+                     .ShareProcess(task);
+  if (!thread.Stack().Valid()) {
+    task_manager->Discard(thread);
+    delete start;
+    return {0, MAKE_ERROR(Error::kNoEnoughMemory)};
+  }
+
+  __asm__("cli");
+  task.Proc().threads.push_back(thread.ID());
+  task_manager->Wakeup(&thread);
+  __asm__("sti");
+  return {thread.ID(), MAKE_ERROR(Error::kSuccess)};
+}
+
+WithError<int> JoinThread(uint64_t thread_id) {
+  __asm__("cli");
+  Task &task = task_manager->CurrentTask();
+  auto &proc = task.Proc();
+
+  while (IsRunningThread(proc, thread_id)) {
+    if (!proc.thread_exit.Wait(task)) {
+      __asm__("sti");
+      return {0, MAKE_ERROR(Error::kInterrupted)};
+    }
+  }
+
+  auto it = proc.thread_results.find(thread_id);
+  if (it == proc.thread_results.end()) {
+    __asm__("sti");
+    return {0, MAKE_ERROR(Error::kNoSuchTask)};
+  }
+  const int exit_code = it->second;
+  proc.thread_results.erase(it);
+  __asm__("sti");
+  return {exit_code, MAKE_ERROR(Error::kSuccess)};
+}
+
+void StopThreads(Task &task) {
+  __asm__("cli");
+  auto &proc = task.Proc();
+  proc.exiting = true;
+  // 眠っているスレッドも起こし，終了要求に気付かせる
+  for (uint64_t thread_id : proc.threads) {
+    task_manager->Wakeup(thread_id);
+  }
+  while (!proc.threads.empty()) {
+    proc.thread_exit.Wait(task);
+  }
+  proc.thread_results.clear();
+  proc.exiting = false;
+  __asm__("sti");
+}
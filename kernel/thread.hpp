@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+#include "error.hpp"
+#include "task.hpp"
+
+WithError<uint64_t> CreateThread(uint64_t entry, uint64_t stack_top,
+                                 uint64_t arg);
+WithError<int> JoinThread(uint64_t thread_id);
+void StopThreads(Task &task);
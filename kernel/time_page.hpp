@@ -0,0 +1,27 @@
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdint.h>
+#endif
+
+// すべてのアプリに読み込み専用で写される時刻のページ
+#define TIME_PAGE_ADDR 0xffffffffffffc000ull
+
+// カーネルはタイマ割り込みごとに seq を奇数にしてから書き換え，偶数に戻す．
+// 読む側は seq が偶数で，読む前後で変わっていなければ値を信用できる
+struct TimePage {
+  volatile uint32_t seq;
+  uint32_t timer_freq; // tick の周波数
+  volatile uint64_t tick;
+  volatile uint64_t tick_tsc; // tick を進めたときの TSC
+  uint64_t tsc_freq;
+  uint64_t tsc_to_ns; // ns = (TSC の差 * tsc_to_ns) >> 32
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,13 +1,20 @@
 #include "timer.hpp"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <deque>
 #include <limits>
 
 #include "acpi.hpp"
+#include "asmfunc.hpp"
 #include "interrupt.hpp"
+#include "logger.hpp"
+#include "memory_manager.hpp"
 #include "message.hpp"
+#include "paging.hpp"
 #include "task.hpp"
+#include "workqueue.hpp"
 
 namespace {
 const uint32_t kCountMax = 0xffffffffu;
@@ -15,6 +22,8 @@ volatile uint32_t &lvt_timer = *reinterpret_cast<uint32_t *>(0xfee00320);
 volatile uint32_t &initial_count = *reinterpret_cast<uint32_t *>(0xfee00380);
 volatile uint32_t &current_count = *reinterpret_cast<uint32_t *>(0xfee00390);
 volatile uint32_t &divide_config = *reinterpret_cast<uint32_t *>(0xfee003e0);
+
+LockStats timer_lock_stats{"timer_manager"};
 } // namespace
 
 void InitializeLAPICTimer() {
@@ -23,12 +32,15 @@ void InitializeLAPICTimer() {
   divide_config = 0b1011;
   lvt_timer = (0b001 << 16);
 
+  const uint64_t tsc_start = ReadTSC();
   StartLAPICTimer();
   acpi::WaitMilliseconds(100);
   const auto elapsed = LAPICTimerElapsed();
   StopLAPICTimer();
+  const uint64_t tsc_end = ReadTSC();
 
   lapic_timer_freq = static_cast<unsigned long>(elapsed) * 10;
+  tsc_freq = (tsc_end - tsc_start) * 10;
 
   divide_config = 0b1011;
   lvt_timer = (0b010 << 16) | InterruptVector::kLAPICTimer;
@@ -50,47 +62,108 @@ void StopLAPICTimer() {
 Timer::Timer(unsigned long timeout, int value, uint64_t task_id)
     : timeout(timeout), value(value), task_id(task_id) {}
 
-TimerManager::TimerManager() {
+TimerManager::TimerManager() : lock{timer_lock_stats} {
   timers.push(Timer{std::numeric_limits<unsigned long>::max(), -1, 1});
 }
 
 void TimerManager::AddTimer(const Timer &timer) {
+  SpinLockGuard guard{lock};
   timers.push(timer);
+  next_timeout = timers.top().Timeout();
+}
+
+void TimerManager::CancelTimer(const Timer &timer) {
+  SpinLockGuard guard{lock};
+  if (timer.Timeout() > tick) {
+    cancelled.push_back(timer);
+  }
 }
 
-bool TimerManager::Tick() {
+// 割り込みハンドラでは期限を確かめるだけにして，通知はワーカに任せる
+void TimerManager::Tick() {
+  tick_tsc = ReadTSC();
   ++tick;
 
-  bool task_timer_timeout = false;
-  while (true) {
-    const auto &t = timers.top();
-    if (t.Timeout() > tick) {
-      break;
-    }
+  if (time_page) {
+    ++time_page->seq;
+    time_page->tick = tick;
+    time_page->tick_tsc = tick_tsc;
+    ++time_page->seq;
+  }
+
+  if (tick >= next_timeout) {
+    QueueWork(kWorkQueueTimer, [](uint64_t) { timer_manager->Expire(); });
+  }
+}
 
-    if (t.Value() == kTaskTimerValue) {
-      task_timer_timeout = true;
-      timers.pop();
-      timers.push(Timer{tick + kTaskTimerPeriod, kTaskTimerValue, 1});
+void TimerManager::Expire() {
+  // タスクへの通知はロックを放してから行う．通知でイベントリングの
+  // futex を起こすと割り込みの状態が変わりうる
+  while (auto t = PopExpired()) {
+    // 待ち行列の期限は起こすだけでよい．メッセージにすると，待ち終えた後に
+    // 古い kTimerTimeout が残る
+    if (t->Value() == kWaitTimerValue) {
+      task_manager->Wakeup(t->TaskID());
       continue;
     }
-
     Message m{Message::kTimerTimeout};
-    m.arg.timer.timeout = t.Timeout();
-    m.arg.timer.value = t.Value();
-    task_manager->SendMessage(t.TaskID(), m);
+    m.arg.timer.timeout = t->Timeout();
+    m.arg.timer.value = t->Value();
+    task_manager->SendMessage(t->TaskID(), m);
+  }
+}
 
+std::optional<Timer> TimerManager::PopExpired() {
+  SpinLockGuard guard{lock};
+  while (true) {
+    const Timer t = timers.top();
+    if (t.Timeout() > tick) {
+      next_timeout = t.Timeout();
+      return std::nullopt;
+    }
     timers.pop();
+    next_timeout = timers.top().Timeout();
+
+    auto it = std::find_if(cancelled.begin(), cancelled.end(),
+                           [&t](const Timer &c) {
+                             return c.Timeout() == t.Timeout() &&
+                                    c.Value() == t.Value() &&
+                                    c.TaskID() == t.TaskID();
+                           });
+    if (it == cancelled.end()) {
+      return t;
+    }
+    cancelled.erase(it);
   }
-
-  return task_timer_timeout;
 }
 
-extern "C" void LAPICTimerOnInterrupt(const TaskContext &ctx_stack) {
-  const bool task_timer_timeout = timer_manager->Tick();
+extern "C" TaskSwitch LAPICTimerOnInterrupt(uint64_t cs) {
+  timer_manager->Tick();
   NotifyEndOfInterrupt();
+  return task_manager->Preempt(cs);
+}
+
+void InitializeTimePage() {
+  auto [frame, err] = memory_manager->Allocate(1);
+  if (err) {
+    Log(kError, "failed to allocate the time page: %s\n", err.Name());
+    return;
+  }
+  auto page = reinterpret_cast<TimePage *>(frame.Frame());
+  memset(page, 0, 4096);
+  page->timer_freq = kTimerFreq;
+  page->tsc_freq = tsc_freq;
+  page->tsc_to_ns = (1'000'000'000ul << 32) / tsc_freq;
+  page->tick = timer_manager->CurrentTick();
+  page->tick_tsc = timer_manager->TickTSC();
+  time_page = page;
+}
 
-  if (task_timer_timeout) {
-    task_manager->SwitchTask(ctx_stack);
+Error MapTimePage() {
+  if (time_page == nullptr) {
+    return MAKE_ERROR(Error::kSuccess);
   }
+  // 書き込み不可のページは CleanPageMaps で解放されない
+  return MapPhysicalPages(LinearAddress4Level{TIME_PAGE_ADDR}, 1,
+                          reinterpret_cast<uint64_t>(time_page), false);
 }
@@ -3,10 +3,15 @@
 #include <cstdint>
 #include <deque>
 #include <limits>
+#include <optional>
 #include <queue>
+#include <vector>
 
+#include "lock.hpp"
+#include "error.hpp"
 #include "message.hpp"
 #include "task.hpp"
+#include "time_page.hpp"
 
 void InitializeLAPICTimer();
 void StartLAPICTimer();
@@ -34,17 +39,37 @@ class TimerManager {
 public:
   TimerManager();
   void AddTimer(const Timer &timer);
-  bool Tick();
+  // 期限前に要らなくなったタイマを，期限が来ても通知しないようにする
+  void CancelTimer(const Timer &timer);
+  void Tick();
+  // 期限が来たタイマをタスクに通知する
+  void Expire();
   unsigned long CurrentTick() const { return tick; }
+  // 最後のタイマ割り込みの時刻
+  uint64_t TickTSC() const { return tick_tsc; }
 
 private:
   volatile unsigned long tick{0};
+  volatile uint64_t tick_tsc{0};
+  volatile unsigned long next_timeout{
+      std::numeric_limits<unsigned long>::max()};
+  SpinLock lock;
   std::priority_queue<Timer> timers{};
+  std::vector<Timer> cancelled{}; // 期限が来たら通知せずに捨てる
+
+  // 期限が来たタイマを 1 つ取り出す
+  std::optional<Timer> PopExpired();
 };
 
 inline TimerManager *timer_manager;
+inline TimePage *time_page; // カーネルから見たアドレス
 inline unsigned long lapic_timer_freq;
+inline uint64_t tsc_freq;
 const int kTimerFreq = 100;
 
 const int kTaskTimerPeriod = static_cast<int>(kTimerFreq * 0.02);
-const int kTaskTimerValue = std::numeric_limits<int>::max();
+const int kWaitTimerValue = std::numeric_limits<int>::max() - 1;
+
+void InitializeTimePage();
+// 現在のアプリのアドレス空間に時刻のページを写す
+Error MapTimePage();
@@ -0,0 +1,56 @@
+#include "wait_queue.hpp"
+
+#include <algorithm>
+
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+void CancelWaitTimer(Task &task, unsigned long deadline) {
+  if (deadline != 0 && timer_manager->CurrentTick() < deadline) {
+    timer_manager->CancelTimer(Timer{deadline, kWaitTimerValue, task.ID()});
+  }
+}
+} // namespace
+
+bool WaitQueue::Wait(Task &task, unsigned long deadline, bool interruptible) {
+  Waiter waiter{&task, false};
+  waiters.push_back(&waiter);
+  if (deadline != 0) {
+    timer_manager->AddTimer(Timer{deadline, kWaitTimerValue, task.ID()});
+  }
+
+  // メッセージの到着でも起床するので，起こされたか期限切れになるまで眠る
+  while (!waiter.woken) {
+    const bool expired =
+        deadline != 0 && timer_manager->CurrentTick() >= deadline;
+    if (expired || (interruptible && task.ExitRequested())) {
+      Remove(waiter);
+      CancelWaitTimer(task, deadline);
+      return false;
+    }
+    task.Sleep();
+  }
+  CancelWaitTimer(task, deadline);
+  return true;
+}
+
+void WaitQueue::Remove(Waiter &waiter) {
+  // WakeUp で取り除かれていることもある
+  if (auto it = std::find(waiters.begin(), waiters.end(), &waiter);
+      it != waiters.end()) {
+    waiters.erase(it);
+  }
+}
+
+int WaitQueue::WakeUp(int num_waiters) {
+  int num_woken = 0;
+  while (num_woken < num_waiters && !waiters.empty()) {
+    Waiter *waiter = waiters.front();
+    waiters.pop_front();
+    waiter->woken = true;
+    task_manager->Wakeup(waiter->task);
+    ++num_woken;
+  }
+  return num_woken;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <deque>
+
+class Task;
+
+class WaitQueue {
+public:
+  struct Waiter {
+    Task *task;
+    bool woken;
+  };
+
+  // いずれも割り込み禁止状態で呼び出す
+  // interruptible なら終了を要求されたスレッドは待たずに戻る
+  bool Wait(Task &task, unsigned long deadline = 0, bool interruptible = true);
+  int WakeUp(int num_waiters);
+  bool Empty() const { return waiters.empty(); }
+
+  // 複数の待ち行列で同時に待つ（poll）ときは，すべてに Add してから眠り，
+  // 起きたら Remove する
+  void Add(Waiter &waiter) { waiters.push_back(&waiter); }
+  void Remove(Waiter &waiter);
+
+private:
+  std::deque<Waiter *> waiters;
+};
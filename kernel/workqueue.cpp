@@ -0,0 +1,95 @@
+#include "workqueue.hpp"
+
+#include "asmfunc.hpp"
+#include "percpu.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+// ワーカが続けて処理する時間．超えたら同じレベルのタスクに譲る
+const uint64_t kWorkBudgetUs = 2000;
+
+const char *const kWorkQueueNames[kNumWorkQueues] = {"timer", "usb"};
+
+void TaskWorker(uint64_t task_id, int64_t data) {
+  auto queue = reinterpret_cast<WorkQueue *>(data);
+  queue->Run(task_manager->CurrentTask());
+}
+} // namespace
+
+WorkQueue::WorkQueue(const char *name) : name{name} {}
+
+bool WorkQueue::Push(WorkFunc *func, uint64_t arg) {
+  const uint32_t t = tail;
+  if (t - head == kCapacity) {
+    ++stats.dropped;
+    return false;
+  }
+  ring[t % kCapacity] = {func, arg, ReadTSC()};
+  __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+
+  ++stats.enqueued;
+  if (const uint64_t backlog = t + 1 - head; backlog > stats.max_backlog) {
+    stats.max_backlog = backlog;
+  }
+  if (worker_sleeping) {
+    worker_sleeping = false;
+    task_manager->Wakeup(worker);
+  }
+  return true;
+}
+
+void WorkQueue::Run(Task &worker) {
+  this->worker = &worker;
+  while (true) {
+    __asm__("cli");
+    if (head == tail) {
+      worker_sleeping = true;
+      worker.Sleep();
+      __asm__("sti");
+      continue;
+    }
+    __asm__("sti");
+    Drain();
+  }
+}
+
+void WorkQueue::Drain() {
+  const uint64_t budget_end = ReadTSC() + tsc_freq / 1000000 * kWorkBudgetUs;
+  while (head != __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) {
+    const Work work = ring[head % kCapacity];
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+
+    const uint64_t latency = ReadTSC() - work.enqueue_tsc;
+    stats.total_latency_tsc += latency;
+    if (latency > stats.max_latency_tsc) {
+      stats.max_latency_tsc = latency;
+    }
+
+    work.func(work.arg);
+    ++stats.processed;
+
+    if (ReadTSC() >= budget_end) {
+      ++stats.yields;
+      task_manager->Yield();
+      return;
+    }
+  }
+}
+
+void InitializeWorkQueues() {
+  auto &cpu = ThisCPU();
+  for (int i = 0; i < kNumWorkQueues; ++i) {
+    auto queue = new WorkQueue{kWorkQueueNames[i]};
+    Task &worker = task_manager->NewTask().InitContext(
+        TaskWorker, reinterpret_cast<int64_t>(queue));
+    cpu.workqueues[i] = queue;
+    // 入力の処理が遅れないよう，メインタスクと同じ最高レベルで動かす
+    task_manager->Wakeup(&worker, TaskManager::kMaxLevel);
+  }
+}
+
+bool QueueWork(WorkQueueID id, WorkFunc *func, uint64_t arg) {
+  auto queue = ThisCPU().workqueues[id];
+  return queue && queue->Push(func, arg);
+}
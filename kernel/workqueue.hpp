@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+class Task;
+
+using WorkFunc = void(uint64_t arg);
+
+// 割り込みハンドラから後回しにした処理
+struct Work {
+  WorkFunc *func;
+  uint64_t arg;
+  uint64_t enqueue_tsc;
+};
+
+struct WorkQueueStats {
+  uint64_t enqueued, processed;
+  uint64_t dropped;           // 満杯で積めなかった回数
+  uint64_t max_backlog;       // 積んだ直後の未処理数の最大
+  uint64_t yields;            // 時間予算を使い切って譲った回数
+  uint64_t total_latency_tsc; // 積んでから処理を始めるまで
+  uint64_t max_latency_tsc;
+};
+
+// 割り込みハンドラが積み，ワーカタスクが取り出すリングバッファ．
+// 割り込みハンドラどうしは入れ子にならないので，生産者も消費者も 1 つになり
+// ロックなしで受け渡せる
+class WorkQueue {
+public:
+  static const uint32_t kCapacity = 256;
+
+  explicit WorkQueue(const char *name);
+  const char *Name() const { return name; }
+  // 割り込み禁止で呼ぶ．満杯なら false
+  bool Push(WorkFunc *func, uint64_t arg);
+  uint32_t Backlog() const { return tail - head; }
+  const WorkQueueStats &Stats() const { return stats; }
+
+  // ワーカタスクの本体
+  void Run(Task &worker);
+
+private:
+  const char *name;
+  std::array<Work, kCapacity> ring;
+  volatile uint32_t head{0}, tail{0};
+  Task *worker{nullptr};
+  volatile bool worker_sleeping{false};
+  WorkQueueStats stats{};
+
+  void Drain();
+};
+
+enum WorkQueueID {
+  kWorkQueueTimer,
+  kWorkQueueUSB,
+  kNumWorkQueues,
+};
+
+// ワーカタスクを作り，ThisCPU() のキューを用意する
+void InitializeWorkQueues();
+// 割り込み禁止で呼ぶ．初期化前やキューが満杯なら false
+bool QueueWork(WorkQueueID id, WorkFunc *func, uint64_t arg = 0);
@@ -0,0 +1,58 @@
+#include "xsave.hpp"
+
+#include <cstring>
+
+#include "asmfunc.hpp"
+#include "cpuid.hpp"
+#include "logger.hpp"
+
+extern "C" ExtendedStateMode ext_state_mode = kExtStateFXSave;
+
+namespace {
+const uint64_t kCR4OSXSave = 1ul << 18;
+
+const uint64_t kXCR0X87 = 1ul << 0;
+const uint64_t kXCR0SSE = 1ul << 1;
+const uint64_t kXCR0AVX = 1ul << 2;
+const uint64_t kXCR0AVX512 = 0b111ul << 5; // opmask, ZMM_Hi256, Hi16_ZMM
+} // namespace
+
+void InitializeExtendedState() {
+  const bool has_xsave = (CPUID(1, 0).ecx >> 26) & 1;
+  if (!has_xsave || CPUID(0, 0).eax < 0xd) {
+    Log(kWarn, "XSAVE is not supported: falling back to FXSAVE\n");
+    return;
+  }
+
+  SetCR4(GetCR4() | kCR4OSXSave);
+
+  const auto xsave_leaf = CPUID(0xd, 0);
+  const uint64_t supported =
+      xsave_leaf.eax | static_cast<uint64_t>(xsave_leaf.edx) << 32;
+
+  uint64_t xcr0 = kXCR0X87 | kXCR0SSE;
+  if (supported & kXCR0AVX) {
+    xcr0 |= kXCR0AVX;
+    if ((supported & kXCR0AVX512) == kXCR0AVX512) {
+      xcr0 |= kXCR0AVX512;
+    }
+  }
+  SetXCR0(xcr0);
+  ext_state_xcr0 = xcr0;
+
+  // EBX は現在の XCR0 で有効な機能を保存するのに必要なサイズ
+  ext_state_size = CPUID(0xd, 0).ebx;
+
+  const bool has_xsaveopt = CPUID(0xd, 1).eax & 1;
+  ext_state_mode = has_xsaveopt ? kExtStateXSaveOpt : kExtStateXSave;
+
+  Log(kInfo, "XSAVE enabled: xcr0=%#lx, area=%lu bytes, xsaveopt=%d\n", xcr0,
+      ext_state_size, has_xsaveopt);
+}
+
+void InitExtendedStateArea(void *area) {
+  auto area8 = reinterpret_cast<uint8_t *>(area);
+  memset(area8, 0, ext_state_size);
+  *reinterpret_cast<uint16_t *>(&area8[0]) = 0x037f;  // FCW
+  *reinterpret_cast<uint32_t *>(&area8[24]) = 0x1f80; // MXCSR
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum ExtendedStateMode : uint8_t {
+  kExtStateFXSave = 0,
+  kExtStateXSave = 1,
+  kExtStateXSaveOpt = 2,
+};
+
+extern "C" {
+extern ExtendedStateMode ext_state_mode;
+void SaveExtendedState(void *area);
+void RestoreExtendedState(void *area);
+}
+
+const size_t kExtStateAlign = 64;
+inline size_t ext_state_size = 512;
+inline uint64_t ext_state_xcr0 = 0;
+
+void InitializeExtendedState();
+void InitExtendedStateArea(void *area);